@@ -0,0 +1,53 @@
+//===============================
+// 3pi+ Robot Profiles
+// Geometry and thresholds per 3pi+ edition. The edition is picked by the
+// PlatformIO environment (ROBOT_STANDARD, ROBOT_TURTLE or ROBOT_HYPER in
+// build_flags), Standard if none is given.
+// Motion code asks for degrees and centimetres; the helpers below fold
+// them into integer encoder tick targets at compile time.
+//===============================
+
+#pragma once
+
+#include <stdint.h>
+
+#if defined(ROBOT_TURTLE)
+#define ROBOT_NAME "Turtle"
+#define ROBOT_GEAR_RATIO 75.81
+#elif defined(ROBOT_HYPER)
+#define ROBOT_NAME "Hyper"
+#define ROBOT_GEAR_RATIO 15.25
+#else
+#define ROBOT_NAME "Standard"
+#define ROBOT_GEAR_RATIO 29.86
+#endif
+
+//Drive train
+constexpr float gearRatio = ROBOT_GEAR_RATIO;
+constexpr float encoderCpr = 12.0;        //counts per motor revolution
+constexpr float wheelDiameterCm = 3.1;
+constexpr float trackWidthCm = 9.35;      //effective, tuned on the Standard
+constexpr float profilePi = 3.1416;
+constexpr float ticksPerCm = (encoderCpr * gearRatio) / (wheelDiameterCm * profilePi);
+
+//Sensors
+constexpr uint16_t edgeMarginMin = 150;   //raw line sensor edge margin floor
+
+//Supervisor
+constexpr uint16_t legTimeoutMs = 4000 * (gearRatio / 29.86);  //per maneuver leg
+constexpr uint16_t stallTimeoutMs = 500 * (gearRatio / 29.86); //no wheel tick
+
+//Encoder ticks for a straight move of cm.
+constexpr int16_t cmTicks(float cm) {
+  return (int16_t)(cm * ticksPerCm + (cm < 0 ? -0.5 : 0.5));
+}
+
+//Ticks per wheel for a spin in place (wheels opposite) of deg.
+constexpr int16_t spinTicks(float deg) {
+  return cmTicks(deg * profilePi / 180.0 * trackWidthCm / 2.0);
+}
+
+//Ticks of the moving wheel for a pivot about the other wheel of deg.
+constexpr int16_t pivotTicks(float deg) {
+  return cmTicks(deg * profilePi / 180.0 * trackWidthCm);
+}
@@ -10,8 +10,12 @@
 #include <Arduino.h>
 #include <Pololu3piPlus32U4.h>
 #include <string.h>
+#include <stddef.h>
 #include <Pololu3piPlus32U4IMU.h>
 #include <Wire.h>
+#include <EEPROM.h>
+#include <avr/wdt.h>
+#include "RobotProfile.h"
  
 using namespace Pololu3piPlus32U4;
  
@@ -37,6 +41,452 @@ bool bumpLeft = false;
 bool bumpRight = false;
 uint16_t lineSensVals[5];
 
+//Maneuver targets, folded to encoder ticks for this edition. Tunable at
+//runtime over the serial interface.
+int bumpRevTicks = cmTicks(2.7);
+int bumpPivotTicks = pivotTicks(33);
+int bothRevTicks = cmTicks(5.4);
+int bothSpinTicks = spinTicks(90);
+int cornerRevTicks = cmTicks(5.4);
+int cornerSpinTicks = spinTicks(180);
+int edgeRevTicks = cmTicks(16.3);
+int edgeSpinOuterTicks = spinTicks(40);
+int edgeSpinInnerTicks = spinTicks(107);
+int edgeSpinCenterTicks = spinTicks(87);
+int progressTicks = cmTicks(54.4);
+
+//Adaptive edge thresholds, per line sensor, on raw readings
+const uint8_t edgeShift = 5;          //EWMA alpha = 1/32
+const uint8_t edgeNoiseK = 4;         //margin = K * surface noise
+const uint8_t edgeSeedSamples = 16;   //samples taken by edgeStatsBegin()
+int edgeMinMargin = edgeMarginMin;    //margin floor, raw units
+long edgeMeanQ[5];                    //surface level << edgeShift
+long edgeNoiseQ[5];                   //mean abs deviation << edgeShift
+uint16_t edgeThr[5];                  //enter edge state above this
+uint16_t edgeExit[5];                 //leave edge state below this
+uint8_t edgeMask = 0;                 //bit per sensor in edge state
+int8_t edgeFirst = -1;                //first sensor that crossed, -1 none
+
+//Fast partial line sensor scan (edge watching while roaming)
+const uint8_t linePins[5] = {12, A0, A2, A3, A4};  //DN1-DN5 RC inputs
+const uint8_t lineChargeUs = 10;
+int scanMask = 0x15;                  //sensors watched every pass (1, 3, 5)
+int scanFullEvery = 8;                //full 5 sensor read every n passes
+uint8_t scanCount = 0;
+
+//Battery monitor (4xAAA pack)
+const uint16_t battNominalMv = 4800;  //voltage the motor speeds are tuned at
+const uint16_t battLowMv = 4400;      //low battery warning level
+const uint16_t battValidMv = 3000;    //below this the pack is off (USB power)
+const uint16_t battSampleMs = 200;    //time between battery samples
+uint16_t battMv = 0;                  //filtered battery voltage
+unsigned long battPrevTime = 0;
+bool battLow = false;
+
+//Motor characterization table (EEPROM)
+const uint8_t charSteps = 8;          //PWM points per wheel and direction
+const int charPwmStep = 50;           //table PWM = (i+1)*charPwmStep
+const int eeMotorTable = 0;           //EEPROM address of the table
+const uint8_t motorTableMagic = 0x3A;
+struct MotorTable {
+  uint8_t magic;
+  uint16_t deadband[2][2];            //[wheel][dir] first PWM that moves
+  uint16_t vel[2][2][charSteps];      //[wheel][dir][step] ticks/s
+};
+MotorTable motorTable;
+bool motorTableValid = false;
+
+//Encoder service (index 0 = left, 1 = right)
+const unsigned long encWindowUs = 50000;  //count based velocity window
+const long encSwitchTicks = 8;            //ticks per window to use counts
+const unsigned long encStopUs = 250000;   //no tick for this long = stopped
+int16_t encRaw[2];                        //last raw library counts
+long encTotal[2];                         //ticks since boot, never reset
+long encVel[2];                           //ticks/s
+unsigned long encTime = 0;                //micros() of the last snapshot
+unsigned long encTickTime[2];             //micros() a tick was last seen
+unsigned long encPeriod[2];               //us per tick at the last tick
+int8_t encDir[2];                         //direction of the last tick
+long encWinTotal[2];
+long encWinVel[2];
+unsigned long encWinTime = 0;
+long legMark[2];                          //totals at the start of a leg
+
+//Heading hold: cross-coupled correction of the leg's L/R tick difference
+int headKp = 16;                          //PWM per 8 ticks of difference
+const uint8_t headKpShift = 3;
+
+//Audio feedback
+enum SoundEvent : uint8_t {
+  sndBump,
+  sndEdge,
+  sndCorner,
+  sndDone,
+  sndLowBatt,
+  sndCount
+};
+const int eeFeedback = eeMotorTable + sizeof(MotorTable);
+const uint8_t feedbackMagic = 0x5C;
+struct FeedbackConfig {
+  uint8_t magic;
+  uint8_t volume;     //0-15, 0 = mute
+  uint8_t enabled;    //bit per SoundEvent
+};
+FeedbackConfig feedback = {feedbackMagic, 10, 0x1F};
+uint8_t sndPlaying = sndCount;  //event currently playing
+char sndBuffer[32];             //volume prefix + tune, read by the buzzer ISR
+
+//Display flush scheduler (21x8 layout: one text row = one OLED page)
+const uint8_t dispRows = 8;
+const uint8_t dispAllRows = 0xFF;
+const uint8_t dispTickRows = 2;         //max rows sent per control tick
+const uint16_t dispTickBudgetUs = 5000; //max time spent per control tick
+const uint16_t dispMenuBudgetUs = 20000;
+uint8_t dispPending = 0;                //bit per row waiting to be sent
+uint8_t dispNextRow = 0;                //round robin start row
+uint16_t dispRowUs = 2000;              //measured cost of one row (EWMA)
+
+//Roaming statistics and benchmark log (EEPROM)
+struct RoamStats {
+  unsigned long durationMs;
+  long pathTicks;                 //net forward path, mean of both wheels
+  uint16_t bumps;
+  uint16_t edges;
+  uint16_t corners;
+  unsigned long maneuverMs;       //time in escape maneuvers
+  unsigned long cruiseLoops;      //loop passes without a maneuver
+  unsigned long cruiseUs;         //time of those passes
+};
+struct BenchRecord {
+  uint16_t durationS;
+  uint16_t distCm;
+  uint16_t bumps;
+  uint16_t edges;
+  uint16_t corners;
+  uint16_t maneuverPct;
+  uint16_t loopUs;                //mean cruise loop period
+  uint16_t score;
+};
+const uint8_t benchLogSize = 4;
+const unsigned long benchDurationMs = 60000;
+const int eeBenchLog = eeFeedback + sizeof(FeedbackConfig);
+const uint8_t benchLogMagic = 0xB3;
+struct BenchLog {
+  uint8_t magic;
+  uint8_t next;                   //slot the next record goes to
+  BenchRecord rec[benchLogSize];
+};
+BenchRecord lastRun;                //result of the last roam, for "result"
+bool lastRunValid = false;
+
+//Reaction latency benchmark (Doubt Events)
+const uint8_t latencyTrials = 8;
+const unsigned long latencyTimeoutMs = 10000;  //max cruise time per trial
+const unsigned long latencyDecelUs = 1000000;  //max wait for deceleration
+
+//Escape maneuver learner. Per trigger, each option (turn direction kept
+//or flipped, x angle scale) keeps an EWMA of the time to the next event.
+enum EscapeTrigger : uint8_t {
+  trigBumpL,
+  trigBumpR,
+  trigBumpBoth,
+  trigCorner,
+  trigEdgeSide,
+  trigEdgeInner,
+  trigEdgeCenter,
+  trigCount
+};
+enum TurnKind : uint8_t {
+  turnPivot,                            //one wheel backwards
+  turnSpin                              //in place
+};
+const uint8_t learnOptions = 6;         //option = flip*3 + scale index
+const uint8_t learnDefault = 1;         //unflipped, 100%
+const uint8_t learnScalePct[3] = {67, 100, 133};
+const uint16_t learnCapMs = 10000;      //outcomes above this count as this
+const uint16_t learnInitMs = 3000;
+const uint8_t learnShift = 2;           //EWMA alpha = 1/4
+const uint8_t learnExplore = 8;         //1 in 8 choices is random
+const uint8_t learnMagic = 0x1E;
+struct LearnTable {
+  uint8_t magic;
+  uint16_t score[trigCount][learnOptions];
+};
+const int eeLearn = eeBenchLog + sizeof(BenchLog);
+LearnTable learn;
+int learnEnabled = 1;
+int8_t learnPendTrig = -1;              //maneuver waiting for its outcome
+uint8_t learnPendOpt = 0;
+unsigned long learnPendTime = 0;
+bool learnDirty = false;
+
+//Coverage planner: back and forth lanes on odometry. Covered cells are
+//kept in a grid centred on the start point; edges, bumps and the grid
+//border end a lane.
+const uint8_t coverGridSize = 32;         //cells per side
+const uint8_t coverCellCm = 8;            //cell size = lane spacing
+const uint8_t coverShowMs = 250;          //live numbers refresh
+enum CoverCell : uint8_t {
+  cellOutside,
+  cellNew,
+  cellCovered
+};
+uint8_t coverGrid[coverGridSize * coverGridSize / 8];
+uint16_t coverCells = 0;
+int coverRevTicks = cmTicks(4.0);
+int coverLaneTicks = cmTicks(coverCellCm);
+int coverTurnTicks = spinTicks(90);
+float odoX = 0;                           //cm, along the start heading
+float odoY = 0;                           //cm, to the left of it
+float odoTh = 0;                          //rad, counterclockwise
+long odoMark[2];
+
+//Supervisor: control pass deadlines per motion mode, maneuver leg timeouts
+//and the hardware watchdog. The watchdog first interrupts (safe stop, fault
+//recorded) and resets the robot if it is still not kicked 500ms later.
+enum FaultReason : uint8_t {
+  faultNone,
+  faultWatchdog,                        //control loop hung
+  faultLegTimeout,                      //wheel blocked or encoder dead
+  faultStall,                           //no wheel ticks in a long leg
+  faultCount
+};
+const char faultNames[][12] PROGMEM = {"None", "Watchdog", "Leg timeout", "Stalled"};
+const uint16_t superRoamUs = 20000;     //roam cruise pass deadline
+const uint16_t superLatencyUs = 5000;   //latency trial pass deadline
+const uint16_t superDistUs = 10000;     //set distance pass deadline
+const uint16_t faultMagic = 0xFA17;
+struct FaultRecord {                    //survives the watchdog reset
+  uint16_t magic;
+  uint8_t reason;
+  uint8_t mode;
+};
+struct FaultLog {
+  uint8_t magic;
+  uint8_t count;
+  uint8_t reason;                       //last fault
+  uint8_t mode;
+};
+const int eeFaultLog = eeLearn + sizeof(LearnTable);
+FaultRecord faultRecord __attribute__((section(".noinit")));
+volatile uint8_t superFault = faultNone;
+uint16_t superDeadlineUs = 0;
+uint16_t superMisses = 0;               //passes over the deadline
+unsigned long superWorstUs = 0;         //longest pass
+
+//Maneuver VM: escape sequences as bytecode, one script per situation.
+//Ops and their argument bytes:
+//  opEnd                       end of script
+//  opStop                      motors off
+//  opRev ticks16               reverse straight (heading held)
+//  opFwd ticks16               forward straight
+//  opSpin dir ticks16          spin in place, ticks per wheel
+//  opPivot dir ticks16         pivot, the outer wheel backs up ticks
+//  opWait ms16                 motors off for ms
+//  opBranch cond pc            jump to byte pc if cond holds
+//  opLearn trigger             turns after this use the learner's option
+//A negative ticks16 is a variable: -1 - VmVar. Every script is stepped at
+//most vmMaxSteps ops, so branch loops are bounded.
+enum VmOp : uint8_t {
+  opEnd,
+  opStop,
+  opRev,
+  opFwd,
+  opSpin,
+  opPivot,
+  opWait,
+  opBranch,
+  opLearn,
+  opCount
+};
+enum VmCond : uint8_t {
+  condAlways,
+  condBump,
+  condBumpL,
+  condBumpR,
+  condEdge
+};
+enum VmDir : uint8_t {
+  dirRight,
+  dirLeft
+};
+enum VmVar : uint8_t {
+  varBumpRev,
+  varBumpPivot,
+  varBothRev,
+  varBothSpin,
+  varCornerRev,
+  varCornerSpin,
+  varEdgeRev,
+  varEdgeOuter,
+  varEdgeInner,
+  varEdgeCenter,
+  varCount
+};
+enum VmScript : uint8_t {
+  scrBumpL,
+  scrBumpR,
+  scrBumpBoth,
+  scrCorner,
+  scrEdgeL,
+  scrEdgeInner,
+  scrEdgeCenter,
+  scrEdgeR,
+  scrCount
+};
+#define VM_ARG(v) (uint8_t)((int16_t)(v) & 0xFF), (uint8_t)((uint16_t)(int16_t)(v) >> 8)
+#define VM_VAR(v) VM_ARG(-1 - (v))
+int* const vmVars[varCount] PROGMEM = {
+  &bumpRevTicks, &bumpPivotTicks, &bothRevTicks, &bothSpinTicks,
+  &cornerRevTicks, &cornerSpinTicks, &edgeRevTicks,
+  &edgeSpinOuterTicks, &edgeSpinInnerTicks, &edgeSpinCenterTicks
+};
+//bumps back up again while the bumper stays pressed
+const uint8_t scrBumpLCode[] PROGMEM = {
+  opRev, VM_VAR(varBumpRev),
+  opBranch, condBumpL, 0,
+  opLearn, trigBumpL,
+  opPivot, dirRight, VM_VAR(varBumpPivot),
+  opEnd
+};
+const uint8_t scrBumpRCode[] PROGMEM = {
+  opRev, VM_VAR(varBumpRev),
+  opBranch, condBumpR, 0,
+  opLearn, trigBumpR,
+  opPivot, dirLeft, VM_VAR(varBumpPivot),
+  opEnd
+};
+const uint8_t scrBumpBothCode[] PROGMEM = {
+  opRev, VM_VAR(varBothRev),
+  opBranch, condBump, 0,
+  opLearn, trigBumpBoth,
+  opSpin, dirRight, VM_VAR(varBothSpin),
+  opEnd
+};
+const uint8_t scrCornerCode[] PROGMEM = {
+  opRev, VM_VAR(varCornerRev),
+  opLearn, trigCorner,
+  opSpin, dirRight, VM_VAR(varCornerSpin),
+  opEnd
+};
+const uint8_t scrEdgeLCode[] PROGMEM = {
+  opRev, VM_VAR(varEdgeRev),
+  opLearn, trigEdgeSide,
+  opSpin, dirRight, VM_VAR(varEdgeOuter),
+  opEnd
+};
+const uint8_t scrEdgeInnerCode[] PROGMEM = {
+  opRev, VM_VAR(varEdgeRev),
+  opLearn, trigEdgeInner,
+  opSpin, dirRight, VM_VAR(varEdgeInner),
+  opEnd
+};
+const uint8_t scrEdgeCenterCode[] PROGMEM = {
+  opRev, VM_VAR(varEdgeRev),
+  opLearn, trigEdgeCenter,
+  opSpin, dirRight, VM_VAR(varEdgeCenter),
+  opEnd
+};
+const uint8_t scrEdgeRCode[] PROGMEM = {
+  opRev, VM_VAR(varEdgeRev),
+  opLearn, trigEdgeSide,
+  opSpin, dirLeft, VM_VAR(varEdgeOuter),
+  opEnd
+};
+const uint8_t* const vmScripts[scrCount] PROGMEM = {
+  scrBumpLCode, scrBumpRCode, scrBumpBothCode, scrCornerCode,
+  scrEdgeLCode, scrEdgeInnerCode, scrEdgeCenterCode, scrEdgeRCode
+};
+const uint8_t vmMaxSteps = 32;
+const uint8_t scriptMax = 24;           //bytes per uploaded script
+const uint8_t scriptMagic = 0x5C;
+struct ScriptStore {                    //uploaded scripts replace the built in
+  uint8_t magic;
+  uint8_t valid;                        //bit per VmScript
+  uint8_t code[scrCount][scriptMax];
+};
+const int eeScripts = eeFaultLog + sizeof(FaultLog);
+uint8_t scriptValid = 0;                //EEPROM ScriptStore.valid
+bool vmActive = false;
+bool vmRunning = false;                 //motion op in progress
+uint8_t vmScript;
+bool vmEeprom;                          //running an uploaded script
+uint8_t vmPc;
+uint8_t vmSteps;
+uint8_t vmOp;
+int vmArg;                              //ticks or ms of the running op
+int8_t vmDirL;                          //wheel signs of the running turn
+int8_t vmDirR;
+unsigned long vmOpStart;
+long vmLegL;
+long vmLegR;
+int8_t vmTrig = -1;                     //opLearn trigger, -1 none
+uint8_t vmOpt = learnDefault;
+
+//Serial command interface (USB CDC), one command per line:
+//  get <name> | set <name> <value> | list | start roam|bench|cover | stop
+//  status | result
+//  learn [reset] | fault [clear] | script [<n> <hex>|<n> clear]
+const uint8_t serialLineMax = 64;
+const uint8_t serialBytesPerCall = 16;  //bytes parsed per serialService()
+char serialLine[serialLineMax];
+uint8_t serialLen = 0;
+bool serialOverflow = false;
+char serialStart = 0;                   //mode requested by "start"
+bool serialStop = false;                //set by "stop"
+char runMode = 0;                       //mode loop() is running
+struct Param {
+  const char* name;                     //PROGMEM
+  int* value;
+  int minVal;
+  int maxVal;
+};
+const char pnSpeed[] PROGMEM = "speed";
+const char pnSpeedRev[] PROGMEM = "speedRev";
+const char pnSpeedTurn[] PROGMEM = "speedTurn";
+const char pnEdge[] PROGMEM = "edgeMargin";
+const char pnBumpRev[] PROGMEM = "bumpRev";
+const char pnBumpPivot[] PROGMEM = "bumpPivot";
+const char pnBothRev[] PROGMEM = "bothRev";
+const char pnBothSpin[] PROGMEM = "bothSpin";
+const char pnCornerRev[] PROGMEM = "cornerRev";
+const char pnCornerSpin[] PROGMEM = "cornerSpin";
+const char pnEdgeRev[] PROGMEM = "edgeRev";
+const char pnEdgeOuter[] PROGMEM = "edgeSpinOuter";
+const char pnEdgeInner[] PROGMEM = "edgeSpinInner";
+const char pnEdgeCenter[] PROGMEM = "edgeSpinCenter";
+const char pnProgress[] PROGMEM = "progress";
+const char pnLearn[] PROGMEM = "learn";
+const char pnHeadKp[] PROGMEM = "headKp";
+const char pnCoverRev[] PROGMEM = "coverRev";
+const char pnCoverTurn[] PROGMEM = "coverTurn";
+const char pnScanMask[] PROGMEM = "scanMask";
+const char pnScanFull[] PROGMEM = "scanFull";
+const Param params[] PROGMEM = {
+  {pnSpeed, &motorSpeed, 0, 400},
+  {pnSpeedRev, &motorSpeedRev, 0, 400},
+  {pnSpeedTurn, &motorSpeedTurn, 0, 400},
+  {pnEdge, &edgeMinMargin, 0, 4000},
+  {pnBumpRev, &bumpRevTicks, 0, 10000},
+  {pnBumpPivot, &bumpPivotTicks, 0, 10000},
+  {pnBothRev, &bothRevTicks, 0, 10000},
+  {pnBothSpin, &bothSpinTicks, 0, 10000},
+  {pnCornerRev, &cornerRevTicks, 0, 10000},
+  {pnCornerSpin, &cornerSpinTicks, 0, 10000},
+  {pnEdgeRev, &edgeRevTicks, 0, 10000},
+  {pnEdgeOuter, &edgeSpinOuterTicks, 0, 10000},
+  {pnEdgeInner, &edgeSpinInnerTicks, 0, 10000},
+  {pnEdgeCenter, &edgeSpinCenterTicks, 0, 10000},
+  {pnProgress, &progressTicks, 0, 30000},
+  {pnLearn, &learnEnabled, 0, 1},
+  {pnHeadKp, &headKp, 0, 200},
+  {pnCoverRev, &coverRevTicks, 0, 2000},
+  {pnCoverTurn, &coverTurnTicks, 0, 2000},
+  {pnScanMask, &scanMask, 1, 31},
+  {pnScanFull, &scanFullEvery, 1, 100},
+};
+const uint8_t paramCount = sizeof(params) / sizeof(params[0]);
+
 //Two chevrons pointing up.
 const char forwardArrows[] PROGMEM = {
   0b00000,
@@ -107,6 +557,15 @@ const char reload[] PROGMEM = {
   0B00000
 };
 
+//Event tunes (Pololu buzzer syntax), indexed by SoundEvent.
+const char tuneBump[] PROGMEM = "O5 L32 c";
+const char tuneEdge[] PROGMEM = "O6 L32 c e";
+const char tuneCorner[] PROGMEM = "O5 L16 g e c";
+const char tuneDone[] PROGMEM = "O5 L16 c e g >c";
+const char tuneLowBatt[] PROGMEM = "O4 L8 c r c";
+const char* const eventTunes[] PROGMEM = {tuneBump, tuneEdge, tuneCorner, tuneDone, tuneLowBatt};
+const char eventNames[][8] PROGMEM = {"Bump   ", "Edge   ", "Corner ", "Done   ", "LowBatt"};
+
 //Menu display declarations
 char mainMenu(char);
 char opMenu(char);
@@ -124,11 +583,102 @@ void feedbackSet(int);
 
 //Operation modes declarations
 void turtleAuto();
+bool roam(unsigned long, RoamStats*);
+void benchmark();
+BenchRecord benchScore(const RoamStats*);
+void roamSense();
+void edgeStatsBegin();
+void edgeUpdate(uint8_t);
+void edgeSetThreshold(uint8_t);
+void lineScanFast(uint8_t, uint16_t*);
+void legReverse(int);
+void legTurn(uint8_t, bool, int);
+
+//Supervisor functions
+void superBoot();
+void superBegin(uint16_t);
+void superEnd();
+bool superPass(unsigned long);
+bool superLeg(unsigned long);
+bool superStall(unsigned long);
+void superStop(uint8_t);
+void superPersist();
+void superPrint();
+void superShowFault();
+
+//Maneuver VM functions
+void vmBegin();
+void vmStart(uint8_t);
+bool vmStep();
+bool vmOpDone();
+void vmAbort();
+uint8_t vmFetch();
+int vmFetchArg();
+bool vmCond(uint8_t);
+uint8_t opSize(uint8_t);
+bool scriptCheck(const uint8_t*, uint8_t);
+void scriptPrint(uint8_t);
+
+//Escape learner functions
+void learnBegin();
+void learnReset();
+uint8_t learnChoose(uint8_t);
+void learnEvent();
+void learnCancel();
+void learnSave();
+void learnPrint();
+
+//Coverage planner functions
+void coverage();
+bool legShift(int);
+void odoBegin();
+void odoUpdate();
+uint8_t coverMark();
+void coverPrint(unsigned long);
+bool latencyTrial(bool, unsigned long*);
+void printLatencyRow(uint8_t, const char*, unsigned long*, uint8_t);
 void doubtEvents();
 void setDist();
 
 //Conversion functions
-float tick2cm(int);
+float tick2cm(long);
+
+//Battery functions
+void batteryUpdate();
+int batteryCompensate(int);
+void setMotors(int, int);
+void batteryPrint();
+
+//Motor characterization functions
+void loadMotorTable();
+void measureWheels(int, int, long*, long*);
+bool characterizeMotors();
+long motorVelocityAt(uint8_t, int);
+int motorFeedForward(uint8_t, long);
+int matchPwm(uint8_t, int);
+void setMotorsFF(int, int);
+void driveStraight(int, long, long);
+
+//Audio feedback functions
+void loadFeedback();
+void playEvent(uint8_t);
+
+//Display flush scheduler functions
+void displayQueue(uint8_t);
+uint8_t displayService(uint8_t, uint16_t);
+
+//Encoder service functions
+void encoderSnapshot(int16_t*, int16_t*, unsigned long*);
+void encoderBegin();
+void encoderUpdate();
+void legBegin(long*, long*);
+void legUpdate(long*, long*);
+
+//Serial command functions
+void serialService();
+void serialCommand(char*);
+int8_t findParam(const char*);
+void printParam(uint8_t);
 
 void setup() {
   //loads custom characters to memory
@@ -144,6 +694,13 @@ void setup() {
   display.clear();
 
   bumpSensors.calibrate();
+  Serial.begin(115200);
+  batteryUpdate();
+  loadMotorTable();
+  loadFeedback();
+  encoderBegin();
+  superBoot();
+  vmBegin();
 }
 
 void loop() {
@@ -153,6 +710,7 @@ void loop() {
   while (true) {
     //update settings variables
     vel = motorSpeed;
+    runMode = mode;
     //menu switch
     switch (mode) {
     case 0:
@@ -186,6 +744,16 @@ void loop() {
       setDist();
       mode = 1;
       break;
+    case 14:
+      //Benchmark
+      benchmark();
+      mode = 1;
+      break;
+    case 15:
+      //Coverage
+      coverage();
+      mode = 1;
+      break;
     case 21:
       //Motor Speed
       motorSpeed = speed(vel);
@@ -241,9 +809,25 @@ char mainMenu(char mode) {
   display.print("Settings           :B");
   display.gotoXY(0,7);
   display.print("About              :C");
+  batteryPrint();
   display.display();
 
+  unsigned long prevTime = millis();
   while(true) {
+    //refresh battery line once a second
+    if(millis() - prevTime >= 1000) {
+      prevTime = millis();
+      batteryUpdate();
+      batteryPrint();
+      display.displayPartial(2, 0, 23);
+      display.displayPartial(3, 0, 23);
+    }
+    serialService();
+    if(serialStart) {
+      mode = serialStart;
+      serialStart = 0;
+      break;
+    }
     if(buttonA.getSingleDebouncedPress()) {
       mode = 1;
       break;
@@ -278,16 +862,22 @@ char opMenu(char mode) {
   display.display();
 
   int setting = 0;
-  String settings[] = {"Turtle Full Auto  ", "Doubt Events      ", "Set Distance      "};
+  String settings[] = {"Turtle Full Auto  ", "Doubt Events      ", "Set Distance      ", "Benchmark         ", "Coverage          "};
   while(true) {
     display.gotoXY(0,2);
     //display.print("                   ");
     display.gotoXY(0,2);
     display.print(settings[setting]);
     //display.displayPartial(2, 0, 23);
+    serialService();
+    if(serialStart) {
+      mode = serialStart;
+      serialStart = 0;
+      break;
+    }
     if (buttonA.getSingleDebouncedPress()){
       setting++;
-      if (setting == 3) setting = 0;
+      if (setting == 5) setting = 0;
     }
     else if (buttonB.getSingleDebouncedPress()){
       mode = setting + 11;
@@ -323,6 +913,12 @@ int settings(int mode) {
     display.print(settings[setting]);
     display.gotoXY(0,2);
     display.displayPartial(2, 0, 23);
+    serialService();
+    if(serialStart) {
+      mode = serialStart;
+      serialStart = 0;
+      break;
+    }
     if (buttonA.getSingleDebouncedPress()){
       setting++;
       if (setting == 7) setting = 0;
@@ -377,20 +973,21 @@ int speed(int vel){
     display.gotoXY(0,2);
     display.displayPartial(2, 0, 23);
     
-    motors.setSpeeds(vel, vel);
+    setMotors(vel, vel);
     //option exit
     if (buttonC.getSingleDebouncedPress()){
-      motors.setSpeeds(0, 0);
+      setMotors(0, 0);
       motorSpeed = vel;
       return vel;
     }
   }
-  motors.setSpeeds(0, 0);
+  setMotors(0, 0);
   return vel;
 }
 
 void lineSensorsSet(int sens) {
   bool emitterToggle = false;
+  bool thresholdView = false;
   lineSensors.calibrate();
   //lineSensors.emittersOn();
 
@@ -405,31 +1002,51 @@ void lineSensorsSet(int sens) {
   display.gotoXY(0,3);
   display.print("1                   5");
   display.gotoXY(0,5);
-  display.print("Next               :A");
+  display.print("Thresholds         :A");
   display.gotoXY(0,6);
   display.print("Toggle Emitters    :B");
   display.gotoXY(0,7);
   display.print("Back\7              :C");
 
   while(true) {
-    lineSensors.readCalibrated(lineSensVals);
+    uint16_t* shown = lineSensVals;
+    if(thresholdView) {
+      //raw read with emitters on, live adaptive thresholds
+      lineSensors.read(lineSensVals);
+      edgeUpdate(0x1F);
+      shown = edgeThr;
+      display.gotoXY(10,0);
+      display.print("  Threshold");
+      display.gotoXY(0,2);
+      display.print((edgeMask & 0x01) ? "\3" : " ");
+      display.gotoXY(5,2);
+      display.print((edgeMask & 0x02) ? "\3" : " ");
+      display.gotoXY(10,2);
+      display.print((edgeMask & 0x04) ? "\3" : " ");
+      display.gotoXY(15,2);
+      display.print((edgeMask & 0x08) ? "\3" : " ");
+      display.gotoXY(20,2);
+      display.print((edgeMask & 0x10) ? "\3" : " ");
+    } else {
+      lineSensors.readCalibrated(lineSensVals);
+      display.gotoXY(10,0);
+      display.print(" Calibrated");
+    }
 
-    display.gotoXY(10,0);
-    display.print(" Calibrated");
     display.gotoXY(0,4);
-    display.print(lineSensVals[0]);
+    display.print(shown[0]);
     display.print("    ");
     display.gotoXY(4,3);
-    display.print(lineSensVals[1]);
+    display.print(shown[1]);
     display.print("    ");
     display.gotoXY(9,3);
-    display.print(lineSensVals[2]);
+    display.print(shown[2]);
     display.print("    ");
     display.gotoXY(14,3);
-    display.print(lineSensVals[3]);
+    display.print(shown[3]);
     display.print("    ");
     display.gotoXY(17,4);
-    display.print(lineSensVals[4]);
+    display.print(shown[4]);
     display.print("    ");
     display.display();
 
@@ -444,7 +1061,12 @@ void lineSensorsSet(int sens) {
       display.print("Off");
     }
     if (buttonA.getSingleDebouncedPress()) {
-      break;
+      thresholdView = !thresholdView;
+      if(thresholdView) {
+        edgeStatsBegin();
+      }
+      display.gotoXY(0,2);
+      display.print("    2    3    4      ");
     }
     else if(buttonB.getSingleDebouncedPress()) {
       emitterToggle = !emitterToggle;
@@ -522,8 +1144,9 @@ void bumpSensorsSet(int sens) {
 }
 
 void encodersSet(int sens) {
-  encCountsL = encoders.getCountsAndResetLeft();
-  encCountsR = encoders.getCountsAndResetRight();
+  encoderBegin();
+  long baseL = encTotal[0];
+  long baseR = encTotal[1];
 
   display.clear();
   display.setLayout21x8();
@@ -540,25 +1163,18 @@ void encodersSet(int sens) {
   display.print("Back\7              :C");
 
   while(true) {
-    encCountsL = encoders.getCountsLeft();
-    encCountsR = encoders.getCountsRight();
-    if(encCountsL > 32767 || encCountsL < -32767) {
-      encCountsL = encoders.getCountsAndResetLeft();
-    }
-    if(encCountsR > 32767 || encCountsR < -32767) {
-      encCountsR = encoders.getCountsAndResetRight();
-    }
+    encoderUpdate();
     if(buttonA.getSingleDebouncedPress()) {
-      encCountsL = encoders.getCountsAndResetLeft();
-      encCountsR = encoders.getCountsAndResetRight();
+      baseL = encTotal[0];
+      baseR = encTotal[1];
     }
     if(buttonB.isPressed()) {
-      motors.setSpeeds(motorSpeed, motorSpeed);
-      encCountsL = encoders.getCountsLeft();
-      encCountsR = encoders.getCountsRight();
+      setMotors(motorSpeed, motorSpeed);
     } else {
-      motors.setSpeeds(0, 0);
+      setMotors(0, 0);
     }
+    encCountsL = encTotal[0] - baseL;
+    encCountsR = encTotal[1] - baseR;
 
     display.gotoXY(0,3);
     display.print(encCountsL);
@@ -597,7 +1213,68 @@ void encodersSet(int sens) {
 }
 
 void motorsSet(int sens) {
+  display.clear();
+  display.setLayout21x8();
+  display.gotoXY(0,0);
+  display.print("Motors:              ");
+  display.gotoXY(0,2);
+  display.print("Deadband    L     R  ");
+  display.gotoXY(0,5);
+  display.print("Characterize       :A");
+  display.gotoXY(0,6);
+  display.print("Clear Table        :B");
+  display.gotoXY(0,7);
+  display.print("Back\7              :C");
+
+  bool redraw = true;
+  while(true) {
+    if(redraw) {
+      redraw = false;
+      display.gotoXY(0,1);
+      if(motorTableValid) {
+        //L/R velocity ratio at full table PWM
+        long velL = motorTable.vel[0][0][charSteps-1];
+        long velR = motorTable.vel[1][0][charSteps-1];
+        display.print("Table: OK  L/R ");
+        display.print(velR > 0 ? (velL * 100) / velR : 0);
+        display.print("%   ");
+      } else {
+        display.print("Table: None          ");
+      }
+      for(uint8_t dir = 0; dir < 2; dir++) {
+        display.gotoXY(0,3+dir);
+        display.print(dir == 0 ? "Fwd         " : "Rev         ");
+        if(motorTableValid) {
+          display.print(motorTable.deadband[0][dir]);
+          display.print("   ");
+          display.gotoXY(18,3+dir);
+          display.print(motorTable.deadband[1][dir]);
+          display.print("  ");
+        } else {
+          display.print("-     -  ");
+        }
+      }
+      display.display();
+    }
 
+    if(buttonA.getSingleDebouncedPress()) {
+      display.gotoXY(0,1);
+      display.print("Sweeping... C:abort  ");
+      display.display();
+      delay(1000);
+      characterizeMotors();
+      redraw = true;
+    }
+    else if(buttonB.getSingleDebouncedPress()) {
+      motorTable.magic = 0;
+      EEPROM.put(eeMotorTable, motorTable);
+      motorTableValid = false;
+      redraw = true;
+    }
+    if(buttonC.getSingleDebouncedPress()) {
+      break;
+    }
+  }
 }
 
 void inertialSet(int sens) {
@@ -612,7 +1289,61 @@ void inertialSet(int sens) {
 }
 
 void feedbackSet(int sens) {
+  display.clear();
+  display.setLayout21x8();
+  display.gotoXY(0,0);
+  display.print("Feedback:            ");
+  display.gotoXY(0,5);
+  display.print("Next               :A");
+  display.gotoXY(0,6);
+  display.print("Change             :B");
+  display.gotoXY(0,7);
+  display.print("Back\7              :C");
+
+  //item 0 is volume, items 1.. are the events
+  uint8_t item = 0;
+  bool redraw = true;
+  while(true) {
+    if(redraw) {
+      redraw = false;
+      display.gotoXY(0,1);
+      display.print(item == 0 ? ">" : " ");
+      display.print("Volume: ");
+      display.print(feedback.volume);
+      display.print("   ");
+      for(uint8_t i = 0; i < sndCount; i++) {
+        //two events per row
+        display.gotoXY((i % 2) * 10, 2 + i/2);
+        display.print(item == i+1 ? ">" : " ");
+        char name[8];
+        strcpy_P(name, eventNames[i]);
+        display.print(name);
+        display.print((feedback.enabled & (1 << i)) ? "\3" : "-");
+      }
+      display.display();
+    }
 
+    if(buttonA.getSingleDebouncedPress()) {
+      item++;
+      if(item > sndCount) item = 0;
+      redraw = true;
+    }
+    else if(buttonB.getSingleDebouncedPress()) {
+      if(item == 0) {
+        feedback.volume++;
+        if(feedback.volume > 15) feedback.volume = 0;
+        playEvent(sndBump);
+      } else {
+        feedback.enabled ^= (1 << (item-1));
+        playEvent(item-1);
+      }
+      redraw = true;
+    }
+    if(buttonC.getSingleDebouncedPress()) {
+      EEPROM.put(eeFeedback, feedback);
+      break;
+    }
+  }
 }
 
 void about() {
@@ -625,6 +1356,9 @@ void about() {
   display.print("All in one functiona-");
   display.gotoXY(0,3);
   display.print("lity test platform.  ");
+  display.gotoXY(0,4);
+  display.print("Edition: ");
+  display.print(ROBOT_NAME);
   display.gotoXY(0,7);
   display.print("Back\7              :C");
   display.display();
@@ -655,283 +1389,958 @@ void turtleAuto() {
   display.print(" C to STOP ");
   display.display();
 
-  //FSD System
+  RoamStats stats;
+  roam(0, &stats);
+}
+
+//FSD System. Roams until C is pressed or, if durationMs is not 0, for
+//durationMs. Fills in stats; returns false if stopped early with C.
+bool roam(unsigned long durationMs, RoamStats* stats) {
+  memset(stats, 0, sizeof(RoamStats));
+  encoderBegin();
+  long pathStart = encTotal[0] + encTotal[1];
+  unsigned long startTime = millis();
+  bool completed = true;
+
+  long encLocL = 0;
+  long encLocR = 0;
+  legBegin(&encLocL, &encLocR);
+  edgeStatsBegin();
+  learnBegin();
   int avoidCount = 0;
+  bool battWarned = false;
+  unsigned long maneuverUs = 0;
+  serialStop = false;
+  vmActive = false;
+  superBegin(superRoamUs);
   while(true) {
-    //Start Roam
-    int encLocL = encoders.getCountsAndResetLeft();
-    int encLocR = encoders.getCountsAndResetRight();
-    bumpSensors.read();
-    lineSensors.calibrate();
-    lineSensors.emittersOn();
-    lineSensors.readCalibrated(lineSensVals);
+    unsigned long loopStart = micros();
+    bool maneuver = false;
+
+    //Low battery warning (only redrawn on change)
+    if(battLow != battWarned) {
+      battWarned = battLow;
+      display.gotoXY(0,1);
+      display.print(battLow ? "Batt LOW!  " : "           ");
+      display.display();
+    }
 
-    //LEFT ONLY collision redirect (Rev + Turn Right)
-    if(bumpSensors.leftIsPressed() && !bumpSensors.rightIsPressed()) {
-      ledRed(1);
-      motors.setSpeeds(0, 0);
-      encLocL = encoders.getCountsAndResetLeft();
-      encLocR = encoders.getCountsAndResetRight();
-      ledYellow(1);
-      while (encLocL > -100 && encLocR > -100) {
-        motors.setSpeeds(-motorSpeedRev, -motorSpeedRev);
-        encLocL = encoders.getCountsLeft();
-        encLocR = encoders.getCountsRight();
+    //Start Roam (leg ticks = progress since the last maneuver ended)
+    legUpdate(&encLocL, &encLocR);
+    roamSense();
+
+    //Maneuver in progress: one VM step per pass, triggers wait
+    if(vmActive) {
+      maneuver = true;
+      if(!vmStep()) {
+        //back on the table: forget this edge, cruise from here
+        edgeMask = 0;
+        edgeFirst = -1;
+        legBegin(&encLocL, &encLocR);
       }
-      encLocL = encoders.getCountsAndResetLeft();
-      encLocR = encoders.getCountsAndResetRight();
-      while (encLocR > -200) {
-        motors.setSpeeds(0, -motorSpeedTurn);
-        encLocL = encoders.getCountsLeft();
-        encLocR = encoders.getCountsRight();
-      }
-      motors.setSpeeds(0, 0);
-      avoidCount++;
-    } 
-    //RIGHT ONLY collision redirect (Rev + Turn Left)
-    else if(bumpSensors.rightIsPressed() && !bumpSensors.leftIsPressed()) {
-      ledRed(1);
-      motors.setSpeeds(0, 0);
-      encLocL = encoders.getCountsAndResetLeft();
-      encLocR = encoders.getCountsAndResetRight();
-      ledYellow(1);
-      while (encLocL > -100 && encLocR > -100) {
-        motors.setSpeeds(-motorSpeedRev, -motorSpeedRev);
-        encLocL = encoders.getCountsLeft();
-        encLocR = encoders.getCountsRight();
-      }
-      encLocL = encoders.getCountsAndResetLeft();
-      encLocR = encoders.getCountsAndResetRight();
-      while (encLocL > -200) {
-        motors.setSpeeds(-motorSpeedTurn, 0);
-        encLocL = encoders.getCountsLeft();
-        encLocR = encoders.getCountsRight();
-      }
-      motors.setSpeeds(0, 0);
-      avoidCount++;  
     }
-    //BOTH collision redirect (2xRev + 90Turn Right)
-    else if(bumpSensors.leftIsPressed() && bumpSensors.rightIsPressed()) {
+    //No Progress / Corner (Rev + 180Spin Right)
+    else if(avoidCount >= 3) {
+      playEvent(sndCorner);
+      stats->corners++;
+      maneuver = true;
+      //counter driven, says nothing about the last maneuver
+      learnCancel();
+      vmStart(scrCorner);
+      avoidCount = 0;
+    }
+    //Collisions: LEFT (Rev + Turn Right), RIGHT (Rev + Turn Left),
+    //BOTH (2xRev + 90Turn Right)
+    else if(bumpSensors.leftIsPressed() || bumpSensors.rightIsPressed()) {
       ledRed(1);
-      motors.setSpeeds(0, 0);
-      encLocL = encoders.getCountsAndResetLeft();
-      encLocR = encoders.getCountsAndResetRight();
       ledYellow(1);
-      while (encLocL > -200 && encLocR > -200) {
-        motors.setSpeeds(-motorSpeedRev, -motorSpeedRev);
-        encLocL = encoders.getCountsLeft();
-        encLocR = encoders.getCountsRight();
+      playEvent(sndBump);
+      stats->bumps++;
+      maneuver = true;
+      learnEvent();
+      if(!bumpSensors.rightIsPressed()) {
+        vmStart(scrBumpL);
+      } else if(!bumpSensors.leftIsPressed()) {
+        vmStart(scrBumpR);
+      } else {
+        vmStart(scrBumpBoth);
       }
-      encLocL = encoders.getCountsAndResetLeft();
-      encLocR = encoders.getCountsAndResetRight();
-      while (encLocL < 270 || encLocR > -270) {
-        motors.setSpeeds(motorSpeedTurn, -motorSpeedTurn);
-        encLocL = encoders.getCountsLeft();
-        encLocR = encoders.getCountsRight();
-      }
-      motors.setSpeeds(0, 0);
       avoidCount++;
     }
-    //No Progress / Corner (Rev + 180Spin Right)
-    if (avoidCount >= 3) {
-      motors.setSpeeds(0, 0);
-      encLocL = encoders.getCountsAndResetLeft();
-      encLocR = encoders.getCountsAndResetRight();
-      while (encLocL > -200 && encLocR > -200) {
-        motors.setSpeeds(-motorSpeedRev, -motorSpeedRev);
-        encLocL = encoders.getCountsLeft();
-        encLocR = encoders.getCountsRight();
+    //Edge Detection (Rev + Turn), reacts on the first sample that crosses.
+    //The first sensor over the edge picks the script.
+    else if(edgeMask != 0) {
+      playEvent(sndEdge);
+      stats->edges++;
+      maneuver = true;
+      learnEvent();
+      switch (edgeFirst) {
+      case 0:
+        vmStart(scrEdgeL);
+        break;
+      case 2:
+        vmStart(scrEdgeCenter);
+        break;
+      case 4:
+        vmStart(scrEdgeR);
+        break;
+      default:
+        vmStart(scrEdgeInner);
+        break;
       }
-      encLocL = encoders.getCountsAndResetLeft();
-      encLocR = encoders.getCountsAndResetRight();
-      while (encLocL < 540) {
-        motors.setSpeeds(motorSpeedTurn, -motorSpeedTurn);
-        encLocL = encoders.getCountsLeft();
-        encLocR = encoders.getCountsRight();
-      }
-      motors.setSpeeds(0, 0);
-      avoidCount = 0;
     }
-
-    //Edge Detection (Rev + 90Turn Right)
-    if(lineSensVals[0] > 650 && lineSensVals[1] > 650 && lineSensVals[2] > 650 && lineSensVals[3] > 650 && lineSensVals[4] > 650) {
-      
-      for(int i=0; i < 5; i++) {
-        lineSensors.readCalibrated(lineSensVals);
-        if(lineSensVals[i] > 650) {
-          motors.setSpeeds(0, 0);
-          encLocL = encoders.getCountsAndResetLeft();
-          encLocR = encoders.getCountsAndResetRight();
-          while (encLocL > -600 && encLocR > -600) {
-            motors.setSpeeds(-motorSpeedRev, -motorSpeedRev);
-            encLocL = encoders.getCountsLeft();
-            encLocR = encoders.getCountsRight();
-          }
-          encLocL = encoders.getCountsAndResetLeft();
-          encLocR = encoders.getCountsAndResetRight();
-          motors.setSpeeds(0, 0);
-          switch (i) {
-          case 0:
-            encLocL = encoders.getCountsAndResetLeft();
-            encLocR = encoders.getCountsAndResetRight();
-            while (encLocL < 120) {
-              motors.setSpeeds(motorSpeedTurn, -motorSpeedTurn);
-              encLocL = encoders.getCountsLeft();
-              encLocR = encoders.getCountsRight();
-            }
-            motors.setSpeeds(0, 0);
-            break;
-          case 1 || 3:
-            encLocL = encoders.getCountsAndResetLeft();
-            encLocR = encoders.getCountsAndResetRight();
-            while (encLocL < 320) {
-              motors.setSpeeds(motorSpeedTurn, -motorSpeedTurn);
-              encLocL = encoders.getCountsLeft();
-              encLocR = encoders.getCountsRight();
-            }
-            motors.setSpeeds(0, 0);
-            break;
-          case 2:
-            encLocL = encoders.getCountsAndResetLeft();
-            encLocR = encoders.getCountsAndResetRight();
-            while (encLocL < 260) {
-              motors.setSpeeds(motorSpeedTurn, -motorSpeedTurn);
-              encLocL = encoders.getCountsLeft();
-              encLocR = encoders.getCountsRight();
-            }
-            motors.setSpeeds(0, 0);
-            break;
-          case 4:
-            encLocL = encoders.getCountsAndResetLeft();
-            encLocR = encoders.getCountsAndResetRight();
-            while (encLocR < 120) {
-              motors.setSpeeds(-motorSpeedTurn, motorSpeedTurn);
-              encLocL = encoders.getCountsLeft();
-              encLocR = encoders.getCountsRight();
-            }
-            break;
-          default:
-            break;
-          }
-        }
-        motors.setSpeeds(0, 0);
-        //avoidCount++;
-      }
-    }  
-
-    //No Anomalies (Forward)
-    if (!bumpSensors.leftIsPressed() && !bumpSensors.rightIsPressed()) {
+    //No Anomalies (Forward, heading held from the end of the last maneuver)
+    else {
       ledRed(0);
       ledYellow(0);
-      motors.setSpeeds(motorSpeed, motorSpeed);
-      if (encLocL > 2000 || encLocR > 2000) {
+      driveStraight(motorSpeed, encLocL, encLocR);
+      if (encLocL > progressTicks || encLocR > progressTicks) {
         avoidCount = 0;
       }
     }
 
+    //Loop timing
+    unsigned long loopUs = micros() - loopStart;
+    if(maneuver) {
+      maneuverUs += loopUs;
+      stats->maneuverMs = maneuverUs / 1000;
+    } else {
+      stats->cruiseLoops++;
+      stats->cruiseUs += loopUs;
+    }
+    if(!superPass(loopUs)) {
+      setMotors(0, 0);
+      completed = false;
+      break;
+    }
 
     //Stop Roam
-    if(buttonC.getSingleDebouncedPress()) {
-      motors.setSpeeds(0, 0);
+    serialService();
+    if(buttonC.getSingleDebouncedPress() || serialStop) {
+      setMotors(0, 0);
+      completed = (durationMs == 0);
+      break;
+    }
+    if(durationMs != 0 && millis() - startTime >= durationMs) {
+      setMotors(0, 0);
       break;
     }
   }
+  vmAbort();
+  superEnd();
+  superShowFault();
+  //the last maneuver's outcome is cut short by the stop: not scored
+  learnCancel();
+  learnSave();
+  encoderUpdate();
+  stats->durationMs = millis() - startTime;
+  stats->pathTicks = (encTotal[0] + encTotal[1] - pathStart) / 2;
+  lastRun = benchScore(stats);
+  lastRunValid = true;
+  return completed;
 }
 
-void doubtEvents() { 
-
-}
+void benchmark() {
+  display.clear();
+  display.setLayout11x4();
+  display.gotoXY(1,1);
+  display.print("Benchmark");
+  display.gotoXY(3,2);
+  display.print(benchDurationMs / 1000);
+  display.print(" s");
+  display.invert();
+  display.display();
+  delay(2500);
 
-void setDist() {
   display.clear();
   display.noInvert();
+  display.gotoXY(0,0);
+  display.print("Benchmark..");
+  display.gotoXY(0,3);
+  display.print(" C to STOP ");
+  display.display();
+
+  RoamStats stats;
+  bool completed = roam(benchDurationMs, &stats);
+  BenchRecord rec = benchScore(&stats);
+
+  //keep the last benchLogSize completed runs
+  BenchLog log;
+  EEPROM.get(eeBenchLog, log);
+  if(log.magic != benchLogMagic || log.next >= benchLogSize) {
+    memset(&log, 0, sizeof(log));
+    log.magic = benchLogMagic;
+  }
+  uint8_t prev = (log.next + benchLogSize - 1) % benchLogSize;
+  uint16_t prevScore = log.rec[prev].score;
+  if(completed) {
+    log.rec[log.next] = rec;
+    log.next = (log.next + 1) % benchLogSize;
+    EEPROM.put(eeBenchLog, log);
+  }
+
+  display.clear();
   display.setLayout21x8();
   display.gotoXY(0,0);
-  display.print("Set Distance:  Config");
+  display.print(completed ? "Benchmark:      Done " : "Benchmark:   Aborted ");
   display.gotoXY(0,1);
-  display.print("Speed:               ");
+  display.print("Distance: ");
+  display.print(rec.distCm);
+  display.print("cm");
   display.gotoXY(0,2);
-  display.print("Distance:            ");
+  display.print("Coll/min: ");
+  display.print(stats.durationMs ? rec.bumps * 60000.0 / stats.durationMs : 0.0);
   display.gotoXY(0,3);
-  display.print("Direction:           ");
+  display.print("Edges: ");
+  display.print(rec.edges);
+  display.gotoXY(11,3);
+  display.print("Corner: ");
+  display.print(rec.corners);
+  display.gotoXY(0,4);
+  display.print("Maneuver: ");
+  display.print(rec.maneuverPct);
+  display.print("%");
+  display.gotoXY(0,5);
+  display.print("Loop: ");
+  display.print(rec.loopUs);
+  display.print("us");
   display.gotoXY(0,6);
-  display.print(" A        B        C ");
-  display.gotoXY(0,7);
-  display.print(" -       SET       + ");
+  display.print("Score: ");
+  display.print(rec.score);
+  display.gotoXY(11,6);
+  display.print("Prev: ");
+  display.print(prevScore);
   display.gotoXY(0,7);
-  //display.print("               Hold B\7");
+  display.print("History:B     Back\7:C");
+  display.display();
 
-  int dist = 0;
-  bool dir = true;
-  int speed = 0;
-  int speedInt = 0;
-  int modeLoc = 0;
-  int8_t deltaTime = 50; //time in ms
-  double prevTime = 0; 
-  float distCurrent = 0;
-  float encLocL = 0;
-  float encLocR = 0;
-  float velCurrent = 0;
-  float distTotal = 0;
-  
-  while(modeLoc != 4) {
-    switch (modeLoc) {
-    case 0:
+  while(true) {
+    if(buttonB.getSingleDebouncedPress()) {
+      //last runs, newest first
+      display.clear();
       display.gotoXY(0,0);
-      display.print("Set Distance:  Config");
-      display.gotoXY(0,6);
-      display.print(" A        B        C ");
-      display.gotoXY(0,7);
-      display.print(" -       SET       + ");
-      while(true) {
-        display.gotoXY(12,1);
-        display.print("->");
-        display.gotoXY(15,1);
-        display.print(speed);
-        display.print(" ");
-        display.gotoXY(18,1);
-        display.print("cm\4");
-        if(buttonC.getSingleDebouncedPress() && speed < 150) {
-          speed = speed + 15;
-        }
-        else if(buttonA.getSingleDebouncedPress() && speed > 0) {
-          speed = speed - 15;
-        }
-        else if(buttonB.getSingleDebouncedPress()) {
-          // speed = calculo
-          speedInt = (speed * 400)/150;
-          display.gotoXY(0,1);
-          display.print("Speed:         ");
-          modeLoc++;
-          break;
-        }
+      display.print("Benchmark History:   ");
+      display.gotoXY(0,1);
+      display.print("# Dist Coll Man Score");
+      for(uint8_t i = 0; i < benchLogSize; i++) {
+        BenchRecord* r = &log.rec[(log.next + benchLogSize - 1 - i) % benchLogSize];
+        display.gotoXY(0,2+i);
+        display.print(i+1);
+        display.gotoXY(2,2+i);
+        display.print(r->distCm);
+        display.gotoXY(7,2+i);
+        display.print(r->bumps);
+        display.gotoXY(12,2+i);
+        display.print(r->maneuverPct);
+        display.gotoXY(16,2+i);
+        display.print(r->score);
       }
+      display.gotoXY(0,7);
+      display.print("Back\7              :C");
+      display.display();
+    }
+    if(buttonC.getSingleDebouncedPress()) {
       break;
-    case 1:
-      while(true) {
-        display.gotoXY(12,2);
-        display.print("->");
-        display.gotoXY(15,2);
-        display.print(dist);
-        display.print("   ");
-        display.gotoXY(19,2);
-        display.print("cm");
-        if(buttonC.getSingleDebouncedPress() && dist < 9999) {
-          dist = dist + 20;
-        }
-        else if(buttonA.getSingleDebouncedPress() && dist > 0) {
-          dist = dist - 20;
-        }
-        else if(buttonB.getSingleDebouncedPress()) {
-          display.gotoXY(0,2);
-          display.print("Distance:      ");
-          modeLoc++;
-          break;
-        }
+    }
+  }
+}
+
+//Compacts roaming stats into a benchmark record. Score is the distance per
+//minute weighted by the share of time spent cruising (not maneuvering).
+BenchRecord benchScore(const RoamStats* stats) {
+  BenchRecord rec;
+  unsigned long ms = stats->durationMs ? stats->durationMs : 1;
+  rec.durationS = ms / 1000;
+  rec.distCm = tick2cm(max(stats->pathTicks, 0L));
+  rec.bumps = stats->bumps;
+  rec.edges = stats->edges;
+  rec.corners = stats->corners;
+  rec.maneuverPct = min(stats->maneuverMs * 100 / ms, 100UL);
+  rec.loopUs = stats->cruiseLoops ? stats->cruiseUs / stats->cruiseLoops : 0;
+  float cmPerMin = rec.distCm * 60000.0 / ms;
+  rec.score = cmPerMin * (100 - rec.maneuverPct) / 100;
+  return rec;
+}
+
+//Reads the sensors the roaming loop reacts to. Line sensors are read raw
+//and checked against the adaptive edge thresholds: the scanMask sensors by
+//a fast partial scan, all five by a full read every scanFullEvery passes.
+void roamSense() {
+  bumpSensors.read();
+  if(++scanCount >= scanFullEvery) {
+    scanCount = 0;
+    lineSensors.read(lineSensVals);
+    edgeUpdate(0x1F);
+  } else {
+    lineScanFast(scanMask, lineSensVals);
+    edgeUpdate(scanMask);
+  }
+}
+
+//Seeds the surface statistics: level from the first half of the samples,
+//noise from the second half. Call with the robot on the surface.
+void edgeStatsBegin() {
+  const uint8_t half = edgeSeedSamples / 2;
+  long sum[5] = {0, 0, 0, 0, 0};
+  long dev[5] = {0, 0, 0, 0, 0};
+  for(uint8_t n = 0; n < half; n++) {
+    lineSensors.read(lineSensVals);
+    for(uint8_t i = 0; i < 5; i++) sum[i] += lineSensVals[i];
+  }
+  for(uint8_t n = 0; n < half; n++) {
+    lineSensors.read(lineSensVals);
+    for(uint8_t i = 0; i < 5; i++) dev[i] += abs((long)lineSensVals[i] - sum[i] / half);
+  }
+  for(uint8_t i = 0; i < 5; i++) {
+    edgeMeanQ[i] = (sum[i] << edgeShift) / half;
+    edgeNoiseQ[i] = (dev[i] << edgeShift) / half;
+    edgeSetThreshold(i);
+  }
+  edgeMask = 0;
+  edgeFirst = -1;
+}
+
+//Updates the edge state of the sensors in mask from lineSensVals (raw).
+//Samples below the threshold feed the surface statistics; edge samples do
+//not.
+void edgeUpdate(uint8_t mask) {
+  for(uint8_t i = 0; i < 5; i++) {
+    uint16_t val = lineSensVals[i];
+    uint8_t bit = 1 << i;
+    if(!(mask & bit)) {
+      continue;
+    } else if(edgeMask & bit) {
+      if(val < edgeExit[i]) edgeMask &= ~bit;
+    } else if(val > edgeThr[i]) {
+      edgeMask |= bit;
+      if(edgeFirst < 0) edgeFirst = i;
+    } else {
+      long mean = edgeMeanQ[i] >> edgeShift;
+      edgeMeanQ[i] += val - mean;
+      edgeNoiseQ[i] += abs(val - mean) - (edgeNoiseQ[i] >> edgeShift);
+      edgeSetThreshold(i);
+    }
+  }
+  if(edgeMask == 0) {
+    edgeFirst = -1;
+  }
+}
+
+//Recomputes a sensor's thresholds: surface level plus a confidence margin
+//of edgeNoiseK times the noise (at least edgeMinMargin), and half of that
+//margin as hysteresis on the way back.
+void edgeSetThreshold(uint8_t i) {
+  long mean = edgeMeanQ[i] >> edgeShift;
+  long margin = (edgeNoiseQ[i] * edgeNoiseK) >> edgeShift;
+  if(margin < edgeMinMargin) margin = edgeMinMargin;
+  edgeThr[i] = min(mean + margin, 65535L);
+  edgeExit[i] = min(mean + margin / 2, 65535L);
+}
+
+//RC read of only the sensors in mask, with the emitters on, into vals (raw
+//units like lineSensors.read()). Instead of waiting for the slowest channel
+//to time out, each channel is done as soon as it has discharged or passed
+//its own edge threshold: a channel still charged then reads edgeThr + 1,
+//which is all edgeUpdate() needs to know. The scan ends when every channel
+//is done. Sensors outside mask are left as they were.
+void lineScanFast(uint8_t mask, uint16_t* vals) {
+  volatile uint8_t* port[5];
+  uint8_t pinBit[5];
+  uint16_t limit[5];                    //decided once still charged past this
+  uint8_t pending = 0;
+  uint16_t timeout = lineSensors.getTimeout();
+  lineSensors.emittersOn();
+  for(uint8_t i = 0; i < 5; i++) {
+    if(mask & (1 << i)) {
+      port[i] = portInputRegister(digitalPinToPort(linePins[i]));
+      pinBit[i] = digitalPinToBitMask(linePins[i]);
+      limit[i] = min(edgeThr[i], timeout);
+      pending |= 1 << i;
+      pinMode(linePins[i], OUTPUT);
+      digitalWrite(linePins[i], HIGH);
+    }
+  }
+  delayMicroseconds(lineChargeUs);
+  for(uint8_t i = 0; i < 5; i++) {
+    if(pending & (1 << i)) pinMode(linePins[i], INPUT);
+  }
+  unsigned long start = micros();
+  while(pending) {
+    uint16_t t = micros() - start;
+    for(uint8_t i = 0; i < 5; i++) {
+      if(!(pending & (1 << i))) {
+        continue;
+      } else if(!(*port[i] & pinBit[i])) {
+        vals[i] = t;
+        pending &= ~(1 << i);
+      } else if(t > limit[i]) {
+        //past its own threshold: over the edge (or timed out like read())
+        vals[i] = (edgeThr[i] < timeout) ? edgeThr[i] + 1 : timeout;
+        pending &= ~(1 << i);
       }
-      break;
-    case 2:
-      while(true) {
+    }
+  }
+  lineSensors.emittersOff();
+}
+
+//Reverses until either wheel has gone back ticks.
+void legReverse(int ticks) {
+  long encLocL, encLocR;
+  setMotors(0, 0);
+  legBegin(&encLocL, &encLocR);
+  unsigned long legStart = millis();
+  while (encLocL > -ticks && encLocR > -ticks && superLeg(legStart)) {
+    driveStraight(-motorSpeedRev, encLocL, encLocR);
+    legUpdate(&encLocL, &encLocR);
+  }
+  setMotors(0, 0);
+}
+
+//Turns right or left by ticks: a pivot backs up the outer wheel only, a
+//spin runs both wheels opposite until their mean reaches ticks.
+void legTurn(uint8_t kind, bool right, int ticks) {
+  long encLocL, encLocR;
+  legBegin(&encLocL, &encLocR);
+  unsigned long legStart = millis();
+  if(kind == turnPivot) {
+    if(right) {
+      while (encLocR > -ticks && superLeg(legStart)) {
+        setMotorsFF(0, -motorSpeedTurn);
+        legUpdate(&encLocL, &encLocR);
+      }
+    } else {
+      while (encLocL > -ticks && superLeg(legStart)) {
+        setMotorsFF(-motorSpeedTurn, 0);
+        legUpdate(&encLocL, &encLocR);
+      }
+    }
+  } else {
+    int dir = right ? 1 : -1;
+    while ((abs(encLocL) + abs(encLocR)) / 2 < ticks && superLeg(legStart)) {
+      setMotorsFF(dir * motorSpeedTurn, -dir * motorSpeedTurn);
+      legUpdate(&encLocL, &encLocR);
+    }
+  }
+  setMotors(0, 0);
+}
+
+//Coverage planner. Sweeps back and forth lanes one cell apart: at the end
+//of a lane (edge, bump or grid border) it backs up and U-turns onto the
+//next lane. If the side step itself hits a boundary the sweep turns around
+//and continues on the other side, skipping the lanes already swept; when
+//both sides are closed the area is done.
+void coverage() {
+  display.clear();
+  display.setLayout11x4();
+  display.gotoXY(1,1);
+  display.print("Coverage");
+  display.invert();
+  display.display();
+  delay(2500);
+
+  display.clear();
+  display.noInvert();
+  display.setLayout21x8();
+  display.gotoXY(0,0);
+  display.print("Coverage:    Sweeping");
+  display.gotoXY(0,7);
+  display.print("Stop               :C");
+  display.display();
+
+  encoderBegin();
+  odoBegin();
+  memset(coverGrid, 0, sizeof(coverGrid));
+  coverCells = 0;
+  edgeStatsBegin();
+  serialStop = false;
+  superBegin(superRoamUs);
+
+  long encLocL = 0;
+  long encLocR = 0;
+  legBegin(&encLocL, &encLocR);
+  bool laneOut = true;                  //lane heading is the start heading
+  bool sweepLeft = true;                //next lane is to the left of the first
+  uint8_t blocked = 0;                  //side steps blocked in a row
+  uint16_t lanes = 1;
+  bool completed = false;
+  unsigned long startTime = millis();
+  unsigned long prevShow = 0;
+  while(true) {
+    unsigned long passStart = micros();
+    bool maneuver = false;
+
+    legUpdate(&encLocL, &encLocR);
+    roamSense();
+    odoUpdate();
+    bool inside = (coverMark() != cellOutside);
+    bool bump = bumpSensors.leftIsPressed() || bumpSensors.rightIsPressed();
+
+    //End of lane: back up, U-turn one lane over
+    if(bump || edgeMask != 0 || !inside) {
+      maneuver = true;
+      if(bump || edgeMask != 0) {
+        playEvent(bump ? sndBump : sndEdge);
+      }
+      //a leg that timed out is a fault, not a boundary. Odometry is
+      //updated after every leg so each one is taken at its own heading.
+      legReverse(coverRevTicks);
+      if(superFault != faultNone) break;
+      odoUpdate();
+      edgeMask = 0;
+      edgeFirst = -1;
+      bool right = (laneOut != sweepLeft);
+      legTurn(turnSpin, right, coverTurnTicks);
+      if(superFault != faultNone) break;
+      odoUpdate();
+      bool shifted = legShift(coverLaneTicks);
+      if(superFault != faultNone) break;
+      if(shifted) {
+        blocked = 0;
+      } else {
+        //this side is closed: sweep back the other way
+        legReverse(coverRevTicks);
+        if(superFault != faultNone) break;
+        odoUpdate();
+        edgeMask = 0;
+        edgeFirst = -1;
+        sweepLeft = !sweepLeft;
+        blocked++;
+      }
+      legTurn(turnSpin, right, coverTurnTicks);
+      if(superFault != faultNone) break;
+      odoUpdate();
+      laneOut = !laneOut;
+      lanes++;
+      if(blocked >= 2) {
+        setMotors(0, 0);
+        completed = true;
+        break;
+      }
+    }
+
+    //Lane (Forward, heading held from the U-turn)
+    if(!maneuver) {
+      driveStraight(motorSpeed, encLocL, encLocR);
+    } else {
+      legBegin(&encLocL, &encLocR);
+    }
+
+    //Live numbers, a few rows per pass
+    if(millis() - prevShow >= coverShowMs) {
+      prevShow = millis();
+      coverPrint(millis() - startTime);
+      display.gotoXY(0,4);
+      display.print("Lanes: ");
+      display.print(lanes);
+      displayQueue((1 << 1) | (1 << 2) | (1 << 3) | (1 << 4));
+    }
+    displayService(dispTickRows, dispTickBudgetUs);
+
+    if(!superPass(maneuver ? 0 : micros() - passStart)) {
+      setMotors(0, 0);
+      break;
+    }
+    serialService();
+    if(buttonC.getSingleDebouncedPress() || serialStop) {
+      setMotors(0, 0);
+      break;
+    }
+  }
+  setMotors(0, 0);
+  superEnd();
+  display.clear();
+  superShowFault();
+  if(completed) {
+    playEvent(sndDone);
+  }
+
+  display.clear();
+  display.gotoXY(0,0);
+  if(completed) {
+    display.print("Coverage:       Done ");
+  } else if(superFault != faultNone) {
+    display.print("Coverage:      Fault ");
+  } else {
+    display.print("Coverage:    Stopped ");
+  }
+  coverPrint(millis() - startTime);
+  display.gotoXY(0,4);
+  display.print("Lanes: ");
+  display.print(lanes);
+  display.gotoXY(0,5);
+  display.print("Missed deadlines: ");
+  display.print(superMisses);
+  display.gotoXY(0,7);
+  display.print("Back\7              :C");
+  display.display();
+  while(!buttonC.getSingleDebouncedPress()) {
+  }
+}
+
+//Side step onto the next lane: at least minTicks, then on until the robot
+//enters a cell not covered yet (skips swept lanes). Returns false if an
+//edge, bump or the grid border stops it.
+bool legShift(int minTicks) {
+  long encLocL, encLocR;
+  legBegin(&encLocL, &encLocR);
+  //may cross many swept lanes: bounded by stall detection, not time
+  unsigned long legStartUs = micros();
+  while(superStall(legStartUs)) {
+    roamSense();
+    odoUpdate();
+    uint8_t cell = coverMark();
+    if(bumpSensors.leftIsPressed() || bumpSensors.rightIsPressed() || edgeMask != 0 || cell == cellOutside) {
+      setMotors(0, 0);
+      return false;
+    }
+    legUpdate(&encLocL, &encLocR);
+    if(cell == cellNew && (encLocL + encLocR) / 2 >= minTicks) {
+      break;
+    }
+    driveStraight(motorSpeed, encLocL, encLocR);
+  }
+  setMotors(0, 0);
+  return superFault == faultNone;
+}
+
+//Starts odometry at (0, 0), heading 0.
+void odoBegin() {
+  encoderUpdate();
+  odoMark[0] = encTotal[0];
+  odoMark[1] = encTotal[1];
+  odoX = 0;
+  odoY = 0;
+  odoTh = 0;
+}
+
+//Dead reckoning from the wheel ticks since the last call.
+void odoUpdate() {
+  encoderUpdate();
+  float dL = tick2cm(encTotal[0] - odoMark[0]);
+  float dR = tick2cm(encTotal[1] - odoMark[1]);
+  odoMark[0] = encTotal[0];
+  odoMark[1] = encTotal[1];
+  float d = (dL + dR) / 2;
+  float dTh = (dR - dL) / trackWidthCm;
+  float th = odoTh + dTh / 2;
+  odoX += d * cos(th);
+  odoY += d * sin(th);
+  odoTh += dTh;
+}
+
+//Marks the grid cell under the robot and says whether it was new.
+uint8_t coverMark() {
+  int cx = (int)floor(odoX / coverCellCm) + coverGridSize / 2;
+  int cy = (int)floor(odoY / coverCellCm) + coverGridSize / 2;
+  if(cx < 0 || cy < 0 || cx >= coverGridSize || cy >= coverGridSize) {
+    return cellOutside;
+  }
+  uint16_t bit = cy * coverGridSize + cx;
+  uint8_t mask = 1 << (bit & 7);
+  if(coverGrid[bit >> 3] & mask) {
+    return cellCovered;
+  }
+  coverGrid[bit >> 3] |= mask;
+  coverCells++;
+  return cellNew;
+}
+
+//Prints covered area, coverage rate and time on rows 1-3 (21x8 layout).
+void coverPrint(unsigned long elapsedMs) {
+  float area = coverCells * (coverCellCm * coverCellCm / 10000.0);
+  display.gotoXY(0,1);
+  display.print("Area: ");
+  display.print(area);
+  display.print("m2    ");
+  display.gotoXY(0,2);
+  display.print("Rate: ");
+  display.print(elapsedMs ? area * 60000.0 / elapsedMs : 0.0);
+  display.print("m2/min  ");
+  display.gotoXY(0,3);
+  display.print("Time: ");
+  display.print(elapsedMs / 1000);
+  display.print("s    ");
+}
+
+//Reaction latency benchmark. Each trial cruises at motorSpeed until a bump
+//or a line sensor crossing its edge threshold, then brakes and times:
+//  Smp: sensing period, i.e. how late the event can be seen at most
+//  Cmd: previous sample -> motor command (worst case detection to brake)
+//  Dec: detection -> both wheels below half the detection speed
+void doubtEvents() {
+  display.clear();
+  display.setLayout21x8();
+  display.gotoXY(0,0);
+  display.print("Doubt Events:        ");
+  display.gotoXY(0,5);
+  display.print("Trigger            :A");
+  display.gotoXY(0,6);
+  display.print("Run Trial          :B");
+  display.gotoXY(0,7);
+  display.print("Results\7          :C");
+
+  bool lineTrigger = false;
+  unsigned long samplePeriod[latencyTrials];
+  unsigned long cmdLatency[latencyTrials];
+  unsigned long decelLatency[latencyTrials];
+  long detectVel = 0;                   //sum of speeds at detection, ticks/s
+  uint8_t trials = 0;
+  bool redraw = true;
+  while(trials < latencyTrials) {
+    if(redraw) {
+      redraw = false;
+      display.gotoXY(14,0);
+      display.print(lineTrigger ? "Line   " : "Bump   ");
+      display.gotoXY(0,2);
+      display.print("Trial ");
+      display.print(trials + 1);
+      display.print("/");
+      display.print(latencyTrials);
+      display.print("       ");
+      display.gotoXY(0,3);
+      display.print(lineTrigger ? "Aim at a dark line   " : "Aim at an obstacle   ");
+      display.display();
+    }
+    if(buttonA.getSingleDebouncedPress() && trials == 0) {
+      lineTrigger = !lineTrigger;
+      redraw = true;
+    }
+    else if(buttonB.getSingleDebouncedPress()) {
+      delay(500);
+      unsigned long result[4];
+      if(latencyTrial(lineTrigger, result)) {
+        samplePeriod[trials] = result[0];
+        cmdLatency[trials] = result[1];
+        decelLatency[trials] = result[2];
+        detectVel += result[3];
+        trials++;
+      }
+      redraw = true;
+    }
+    if(buttonC.getSingleDebouncedPress()) {
+      break;
+    }
+  }
+
+  //Results: min / median / max per measurement
+  display.clear();
+  display.gotoXY(0,0);
+  display.print("Latency ms: ");
+  display.print(lineTrigger ? "Line" : "Bump");
+  display.gotoXY(0,1);
+  display.print("n=");
+  display.print(trials);
+  display.gotoXY(4,1);
+  display.print("min   med   max");
+  if(trials > 0) {
+    printLatencyRow(2, "Smp", samplePeriod, trials);
+    printLatencyRow(3, "Cmd", cmdLatency, trials);
+    printLatencyRow(4, "Dec", decelLatency, trials);
+    //distance covered between detection and braking (median)
+    float vel = tick2cm(detectVel / trials);
+    display.gotoXY(0,5);
+    display.print("Travel: ");
+    display.print(vel * decelLatency[trials/2] / 1000000.0);
+    display.print("cm");
+  }
+  display.gotoXY(0,7);
+  display.print("Back\7              :C");
+  display.display();
+  while(!buttonC.getSingleDebouncedPress()) {
+  }
+}
+
+//Runs one latency trial. result[] gets the sample period, command latency
+//and deceleration latency in us, and the speed at detection in ticks/s.
+//Returns false on timeout or abort, if the robot was not moving at
+//detection, or if it did not slow down within latencyDecelUs.
+bool latencyTrial(bool lineTrigger, unsigned long* result) {
+  encoderBegin();
+  unsigned long detect;
+  serialStop = false;
+  edgeStatsBegin();
+  superBegin(superLatencyUs);
+  //after the threshold seeding, which is not part of any sample period
+  unsigned long start = millis();
+  unsigned long prevSample = micros();
+  while(true) {
+    setMotorsFF(motorSpeed, motorSpeed);
+    encoderUpdate();
+    detect = micros();
+    if(!superPass(detect - prevSample)) {
+      setMotors(0, 0);
+      superEnd();
+      return false;
+    }
+    roamSense();
+    bool triggered;
+    if(lineTrigger) {
+      triggered = (edgeMask != 0);
+    } else {
+      triggered = bumpSensors.leftIsPressed() || bumpSensors.rightIsPressed();
+    }
+    if(triggered) break;
+    serialService();
+    if(buttonC.getSingleDebouncedPress() || serialStop || millis() - start > latencyTimeoutMs) {
+      setMotors(0, 0);
+      superEnd();
+      return false;
+    }
+    prevSample = detect;
+  }
+  setMotors(0, 0);
+  unsigned long cmd = micros();
+
+  //Decelerated once each wheel's next tick is over twice the tick period
+  //at detection, i.e. below half speed
+  encoderUpdate();
+  long vel = (abs(encVel[0]) + abs(encVel[1])) / 2;
+  if(vel == 0) {
+    //not moving at detection (e.g. already touching): nothing to time
+    superEnd();
+    return false;
+  }
+  unsigned long slowPeriod = 2000000UL / vel;
+  unsigned long decel = cmd;
+  bool slowed = false;
+  while(!slowed && micros() - cmd < latencyDecelUs) {
+    superPass(0);
+    encoderUpdate();
+    decel = encTime;
+    bool slowL = (encTime - encTickTime[0] > slowPeriod) || encPeriod[0] > slowPeriod;
+    bool slowR = (encTime - encTickTime[1] > slowPeriod) || encPeriod[1] > slowPeriod;
+    slowed = slowL && slowR;
+  }
+  superEnd();
+  if(!slowed) {
+    return false;
+  }
+
+  result[0] = detect - prevSample;
+  result[1] = cmd - prevSample;
+  result[2] = decel - detect;
+  result[3] = vel;
+  return true;
+}
+
+//Prints min, median and max of n latencies (us) in ms on a row. Sorts data.
+void printLatencyRow(uint8_t row, const char* label, unsigned long* data, uint8_t n) {
+  for(uint8_t i = 1; i < n; i++) {
+    unsigned long v = data[i];
+    uint8_t j = i;
+    while(j > 0 && data[j-1] > v) {
+      data[j] = data[j-1];
+      j--;
+    }
+    data[j] = v;
+  }
+  display.gotoXY(0,row);
+  display.print(label);
+  display.gotoXY(4,row);
+  display.print(data[0] / 1000.0, 1);
+  display.gotoXY(10,row);
+  display.print(data[n/2] / 1000.0, 1);
+  display.gotoXY(16,row);
+  display.print(data[n-1] / 1000.0, 1);
+}
+
+void setDist() {
+  display.clear();
+  display.noInvert();
+  display.setLayout21x8();
+  display.gotoXY(0,0);
+  display.print("Set Distance:  Config");
+  display.gotoXY(0,1);
+  display.print("Speed:               ");
+  display.gotoXY(0,2);
+  display.print("Distance:            ");
+  display.gotoXY(0,3);
+  display.print("Direction:           ");
+  display.gotoXY(0,6);
+  display.print(" A        B        C ");
+  display.gotoXY(0,7);
+  display.print(" -       SET       + ");
+  display.gotoXY(0,7);
+  //display.print("               Hold B\7");
+
+  int dist = 0;
+  bool dir = true;
+  int speed = 0;
+  int speedL = 0;
+  int speedR = 0;
+  int modeLoc = 0;
+  int8_t deltaTime = 50; //time in ms
+  double prevTime = 0; 
+  float distCurrent = 0;
+  float encLocL = 0;
+  float encLocR = 0;
+  float velCurrent = 0;
+  float distTotal = 0;
+  long startL = 0;
+  long startR = 0;
+  bool distDone = false;
+
+  while(modeLoc != 4) {
+    displayQueue(dispAllRows);
+    switch (modeLoc) {
+    case 0:
+      display.gotoXY(0,0);
+      display.print("Set Distance:  Config");
+      display.gotoXY(0,6);
+      display.print(" A        B        C ");
+      display.gotoXY(0,7);
+      display.print(" -       SET       + ");
+      while(true) {
+        display.gotoXY(12,1);
+        display.print("->");
+        display.gotoXY(15,1);
+        display.print(speed);
+        display.print(" ");
+        display.gotoXY(18,1);
+        display.print("cm\4");
+        displayQueue(1 << 1);
+        displayService(dispRows, dispMenuBudgetUs);
+        if(buttonC.getSingleDebouncedPress() && speed < 150) {
+          speed = speed + 15;
+        }
+        else if(buttonA.getSingleDebouncedPress() && speed > 0) {
+          speed = speed - 15;
+        }
+        else if(buttonB.getSingleDebouncedPress()) {
+          display.gotoXY(0,1);
+          display.print("Speed:         ");
+          modeLoc++;
+          break;
+        }
+      }
+      break;
+    case 1:
+      while(true) {
+        display.gotoXY(12,2);
+        display.print("->");
+        display.gotoXY(15,2);
+        display.print(dist);
+        display.print("   ");
+        display.gotoXY(19,2);
+        display.print("cm");
+        displayQueue(1 << 2);
+        displayService(dispRows, dispMenuBudgetUs);
+        if(buttonC.getSingleDebouncedPress() && dist < 9999) {
+          dist = dist + 20;
+        }
+        else if(buttonA.getSingleDebouncedPress() && dist > 0) {
+          dist = dist - 20;
+        }
+        else if(buttonB.getSingleDebouncedPress()) {
+          display.gotoXY(0,2);
+          display.print("Distance:      ");
+          modeLoc++;
+          break;
+        }
+      }
+      break;
+    case 2:
+      while(true) {
         display.gotoXY(0,7);
         display.print("\1/\2      SEL        ");
         display.gotoXY(12,3);
@@ -942,10 +2351,16 @@ void setDist() {
         } else {
           display.print("REV \2");
         }
+        displayQueue(1 << 3);
+        displayService(dispRows, dispMenuBudgetUs);
         if(buttonA.getSingleDebouncedPress()) {
           dir = !dir;
         }
         else if(buttonB.getSingleDebouncedPress()) {
+          //feed-forward PWM from the characterization table, per direction
+          long vel = (long)(speed * ticksPerCm);
+          speedL = motorFeedForward(0, dir ? vel : -vel);
+          speedR = motorFeedForward(1, dir ? vel : -vel);
           display.gotoXY(0,3);
           display.print("Direction:     ");
           modeLoc++; //consider either new case or exit case and run prog block
@@ -959,28 +2374,40 @@ void setDist() {
       display.print("       ");
       display.gotoXY(16,0);
       display.print(" in 3");
+      displayQueue(1 << 0);
+      displayService(dispRows, dispMenuBudgetUs);
       delay(1000);
       display.gotoXY(16,0);
       display.print(" in 2");
+      displayQueue(1 << 0);
+      displayService(dispRows, dispMenuBudgetUs);
       delay(1000);
       display.gotoXY(16,0);
       display.print(" in 1");
+      displayQueue(1 << 0);
+      displayService(dispRows, dispMenuBudgetUs);
       delay(1000);
       display.gotoXY(0,0);
       display.print("Set Distance: Running");
+      displayQueue(1 << 0);
 
+      encoderBegin();
+      startL = encTotal[0];
+      startR = encTotal[1];
+      serialStop = false;
+      superBegin(superDistUs);
       while(modeLoc != 4) {
+        unsigned long passStart = micros();
+        encoderUpdate();
+        serialService();
         if(millis() - prevTime >= deltaTime) {
           prevTime = millis();
-          encCountsL = encoders.getCountsAndResetLeft();
-          encCountsR = encoders.getCountsAndResetRight();
-
-          distCurrent = (tick2cm(encCountsL) + tick2cm(encCountsR))/2;
-          velCurrent = distCurrent / (deltaTime/1000.0);
+          distCurrent = (tick2cm(encTotal[0] - startL) + tick2cm(encTotal[1] - startR))/2;
+          velCurrent = tick2cm((encVel[0] + encVel[1])/2);
           if (dir) {
-            distTotal += distCurrent;
+            distTotal = distCurrent;
           } else {
-            distTotal -= distCurrent;
+            distTotal = -distCurrent;
           }
           //consider moving motor logic block here
           display.gotoXY(0,4);
@@ -1003,39 +2430,1083 @@ void setDist() {
           display.print("  ");
 
           if((dist - distTotal) >= 0) {
-            if (dir) {
-              motors.setSpeeds(speedInt, speedInt);
-            } else {
-              motors.setSpeeds(-speedInt, -speedInt);
-            }
+            setMotors(speedL, speedR);
           } else {
-            motors.setSpeeds(0, 0);
+            setMotors(0, 0);
+            if(!distDone) {
+              playEvent(sndDone);
+              distDone = true;
+            }
             display.gotoXY(0,0);
             display.print("Set Distance:   Done!");
             display.gotoXY(0,7);
             display.print("          \5        \7 ");
+            displayQueue((1 << 0) | (1 << 7));
           }
+          //live numbers, flushed a few rows per tick
+          displayQueue((1 << 4) | (1 << 5));
+          displayService(dispTickRows, dispTickBudgetUs);
+        }
+        if(!superPass(micros() - passStart)) {
+          setMotors(0, 0);
+          modeLoc = 4;
+          break;
         }
         if(buttonB.getSingleDebouncedPress()) {
-          motors.setSpeeds(0, 0);
+          setMotors(0, 0);
           distTotal = 0;
+          distDone = false;
           modeLoc = 0;
           break;
         }
-        else if(buttonC.getSingleDebouncedPress()) {
-          motors.setSpeeds(0, 0);
+        else if(buttonC.getSingleDebouncedPress() || serialStop) {
+          setMotors(0, 0);
           modeLoc = 4;
           break;
         }
       }
+      superEnd();
     default:
       break;
     }
   }
 }
 
-float tick2cm(int ticks) {
+float tick2cm(long ticks) {
   float cm;
-  cm = ticks * (1.0/12.0) * (1.0/29.86) * ((3.1*3.1416)/1);
+  cm = ticks / ticksPerCm;
   return cm;
 }
+
+//Samples the battery every battSampleMs and low-pass filters it.
+void batteryUpdate() {
+  if(battMv != 0 && millis() - battPrevTime < battSampleMs) {
+    return;
+  }
+  battPrevTime = millis();
+  uint16_t sample = readBatteryMillivolts();
+  if(battMv == 0 || sample < battValidMv || battMv < battValidMv) {
+    //seed the filter (first sample, or pack switched on/off)
+    battMv = sample;
+  } else {
+    //EWMA, alpha = 1/8
+    battMv = battMv + ((int16_t)(sample - battMv) >> 3);
+  }
+  //low battery flag with 100mV hysteresis
+  if(battMv < battValidMv) {
+    battLow = false;
+  } else if(battMv < battLowMv) {
+    if(!battLow) playEvent(sndLowBatt);
+    battLow = true;
+  } else if(battMv > battLowMv + 100) {
+    battLow = false;
+  }
+}
+
+//Scales a speed tuned at battNominalMv to the present battery voltage.
+int batteryCompensate(int speed) {
+  if(battMv < battValidMv) {
+    return speed;
+  }
+  long scaled = ((long)speed * battNominalMv) / battMv;
+  return constrain(scaled, -400, 400);
+}
+
+//Battery compensated motors.setSpeeds().
+void setMotors(int left, int right) {
+  batteryUpdate();
+  motors.setSpeeds(batteryCompensate(left), batteryCompensate(right));
+}
+
+//Prints the battery level on rows 2-3 (21x8 layout).
+void batteryPrint() {
+  display.gotoXY(0,2);
+  display.print("Battery: ");
+  if(battMv < battValidMv) {
+    display.print("USB         ");
+  } else {
+    display.print(battMv / 1000.0);
+    display.print("V       ");
+  }
+  display.gotoXY(0,3);
+  display.print(battLow ? "   ! LOW BATTERY !   " : "                     ");
+}
+
+//Reads the motor characterization table from EEPROM.
+void loadMotorTable() {
+  EEPROM.get(eeMotorTable, motorTable);
+  motorTableValid = (motorTable.magic == motorTableMagic);
+}
+
+//Measures both wheel velocities (ticks/s) at a fixed PWM once settled.
+void measureWheels(int pwmL, int pwmR, long* velL, long* velR) {
+  const uint16_t settleMs = 250;
+  const uint16_t windowMs = 200;
+  setMotors(pwmL, pwmR);
+  delay(settleMs);
+  encoderBegin();
+  long startL = encTotal[0];
+  long startR = encTotal[1];
+  unsigned long start = millis();
+  while(millis() - start < windowMs) {
+    setMotors(pwmL, pwmR);
+    encoderUpdate();
+  }
+  *velL = abs(encTotal[0] - startL) * 1000 / windowMs;
+  *velR = abs(encTotal[1] - startR) * 1000 / windowMs;
+}
+
+//Spins in place sweeping PWM per wheel and direction, then stores the
+//deadband and PWM->velocity table to EEPROM. Returns false if aborted.
+bool characterizeMotors() {
+  const int deadbandStep = 5;
+  const long movingVel = 20;   //ticks/s counted as moving
+  long velL, velR;
+  MotorTable table;
+  table.magic = motorTableMagic;
+
+  //dir 0: left forward, right reverse. dir 1: left reverse, right forward.
+  for(uint8_t dir = 0; dir < 2; dir++) {
+    int signL = (dir == 0) ? 1 : -1;
+    int signR = -signL;
+    uint8_t dirL = dir;
+    uint8_t dirR = 1 - dir;
+
+    //Deadband: smallest PWM that moves each wheel
+    table.deadband[0][dirL] = 0;
+    table.deadband[1][dirR] = 0;
+    for(int pwm = deadbandStep; pwm <= charPwmStep*charSteps; pwm += deadbandStep) {
+      measureWheels(signL*pwm, signR*pwm, &velL, &velR);
+      if(table.deadband[0][dirL] == 0 && velL > movingVel) table.deadband[0][dirL] = pwm;
+      if(table.deadband[1][dirR] == 0 && velR > movingVel) table.deadband[1][dirR] = pwm;
+      if(table.deadband[0][dirL] != 0 && table.deadband[1][dirR] != 0) break;
+      if(buttonC.getSingleDebouncedPress()) {
+        setMotors(0, 0);
+        return false;
+      }
+    }
+
+    //Steady-state velocity at each table PWM
+    for(uint8_t i = 0; i < charSteps; i++) {
+      int pwm = (i+1) * charPwmStep;
+      display.gotoXY(0,2);
+      display.print(dir == 0 ? "L+ R-  PWM " : "L- R+  PWM ");
+      display.print(pwm);
+      display.print("      ");
+      display.displayPartial(2, 0, 23);
+      measureWheels(signL*pwm, signR*pwm, &velL, &velR);
+      table.vel[0][dirL][i] = velL;
+      table.vel[1][dirR][i] = velR;
+      if(buttonC.getSingleDebouncedPress()) {
+        setMotors(0, 0);
+        return false;
+      }
+    }
+    setMotors(0, 0);
+    delay(500);
+  }
+  display.gotoXY(0,2);
+  display.print("Deadband    L     R  ");
+
+  motorTable = table;
+  motorTableValid = true;
+  EEPROM.put(eeMotorTable, motorTable);
+  return true;
+}
+
+//Table velocity (ticks/s) of a wheel at a PWM, interpolated. Sign follows pwm.
+long motorVelocityAt(uint8_t wheel, int pwm) {
+  uint8_t dir = (pwm < 0) ? 1 : 0;
+  long p = abs(pwm);
+  long p0 = motorTable.deadband[wheel][dir];
+  long v0 = 0;
+  long v = 0;
+  if(p > p0) {
+    for(uint8_t i = 0; i < charSteps; i++) {
+      long p1 = (i+1) * charPwmStep;
+      long v1 = motorTable.vel[wheel][dir][i];
+      if(p1 <= p0) continue;
+      v = v1;
+      if(p <= p1) {
+        v = v0 + ((v1 - v0) * (p - p0)) / (p1 - p0);
+        break;
+      }
+      p0 = p1;
+      v0 = v1;
+    }
+  }
+  return (dir == 0) ? v : -v;
+}
+
+//Feed-forward PWM for a wheel velocity in ticks/s. Uses the characterization
+//table when present, else the old linear 150cm/s -> 400 PWM mapping.
+int motorFeedForward(uint8_t wheel, long ticksPerSec) {
+  if(!motorTableValid) {
+    return (ticksPerSec * 400) / (long)(150 * ticksPerCm);
+  }
+  if(ticksPerSec == 0) {
+    return 0;
+  }
+  uint8_t dir = (ticksPerSec < 0) ? 1 : 0;
+  long v = abs(ticksPerSec);
+  long p0 = motorTable.deadband[wheel][dir];
+  long v0 = 0;
+  long pwm = charPwmStep * charSteps;
+  for(uint8_t i = 0; i < charSteps; i++) {
+    long p1 = (i+1) * charPwmStep;
+    long v1 = motorTable.vel[wheel][dir][i];
+    if(p1 <= p0) continue;
+    if(v <= v1) {
+      pwm = (v1 > v0) ? p0 + ((p1 - p0) * (v - v0)) / (v1 - v0) : p1;
+      break;
+    }
+    p0 = p1;
+    v0 = v1;
+  }
+  return (dir == 0) ? pwm : -pwm;
+}
+
+//Per-wheel PWM so both wheels reach the mean table velocity of a nominal PWM.
+int matchPwm(uint8_t wheel, int pwm) {
+  if(!motorTableValid || pwm == 0) {
+    return pwm;
+  }
+  long vel = (motorVelocityAt(0, pwm) + motorVelocityAt(1, pwm)) / 2;
+  return motorFeedForward(wheel, vel);
+}
+
+//setMotors() with table feed-forward matching of the two wheels.
+void setMotorsFF(int left, int right) {
+  setMotors(matchPwm(0, left), matchPwm(1, right));
+}
+
+//Drives straight at speed (negative for reverse). left/right are the leg
+//ticks (legUpdate()); the wheel that got ahead is slowed and the other sped
+//up in proportion to the difference, at most by half the speed.
+void driveStraight(int speed, long left, long right) {
+  long err = (speed < 0) ? right - left : left - right;
+  long corr = (err * headKp) >> headKpShift;
+  int limit = abs(speed) / 2;
+  corr = constrain(corr, -limit, limit);
+  if(speed < 0) corr = -corr;
+  setMotorsFF(speed - corr, speed + corr);
+}
+
+//Reads left and right counts as one consistent pair with a shared timestamp.
+//The library getters re-enable interrupts themselves, so instead of an
+//ATOMIC_BLOCK the left count is re-read until it is unchanged around the
+//right read.
+void encoderSnapshot(int16_t* left, int16_t* right, unsigned long* time) {
+  int16_t l;
+  for(uint8_t tries = 0; tries < 4; tries++) {
+    l = encoders.getCountsLeft();
+    *time = micros();
+    *right = encoders.getCountsRight();
+    if(encoders.getCountsLeft() == l) break;
+  }
+  *left = l;
+}
+
+//Resyncs the service with the raw counts (call after anything else reset
+//the library counts) and clears the velocity estimate.
+void encoderBegin() {
+  encoderSnapshot(&encRaw[0], &encRaw[1], &encTime);
+  for(uint8_t i = 0; i < 2; i++) {
+    encVel[i] = 0;
+    encWinVel[i] = 0;
+    encWinTotal[i] = encTotal[i];
+    encTickTime[i] = encTime;
+    encPeriod[i] = 0;
+    encDir[i] = 0;
+  }
+  encWinTime = encTime;
+}
+
+//Accumulates ticks into the 32-bit totals and updates the velocity
+//estimates. Velocity comes from the tick period at low speed and from the
+//tick count over encWindowUs at high speed. Poll as often as possible; the
+//period resolution is the polling interval.
+void encoderUpdate() {
+  int16_t raw[2];
+  unsigned long now;
+  encoderSnapshot(&raw[0], &raw[1], &now);
+  bool window = (now - encWinTime >= encWindowUs);
+  for(uint8_t i = 0; i < 2; i++) {
+    int16_t delta = raw[i] - encRaw[i];
+    encRaw[i] = raw[i];
+    encTotal[i] += delta;
+    if(delta != 0) {
+      encPeriod[i] = (now - encTickTime[i]) / abs(delta);
+      encTickTime[i] = now;
+      encDir[i] = (delta > 0) ? 1 : -1;
+    }
+    if(window) {
+      encWinVel[i] = ((encTotal[i] - encWinTotal[i]) * 100000L) / (long)((now - encWinTime) / 10);
+      encWinTotal[i] = encTotal[i];
+    }
+
+    unsigned long sinceTick = now - encTickTime[i];
+    if(abs(encWinVel[i]) >= encSwitchTicks * (long)(1000000UL / encWindowUs)) {
+      //high speed: count based
+      encVel[i] = encWinVel[i];
+    } else if(encPeriod[i] == 0 || sinceTick > encStopUs) {
+      encVel[i] = 0;
+    } else {
+      //low speed: period based, decaying while the next tick is late
+      unsigned long period = (sinceTick > encPeriod[i]) ? sinceTick : encPeriod[i];
+      encVel[i] = encDir[i] * (long)(1000000UL / period);
+    }
+  }
+  if(window) {
+    encWinTime = now;
+  }
+  encTime = now;
+}
+
+//Reads the feedback settings from EEPROM, keeping defaults if unset.
+void loadFeedback() {
+  FeedbackConfig stored;
+  EEPROM.get(eeFeedback, stored);
+  if(stored.magic == feedbackMagic && stored.volume <= 15) {
+    feedback = stored;
+  }
+}
+
+//Starts an event tune in the background. Returns immediately; the buzzer
+//plays from its timer interrupt. A tune never cuts off a more important
+//one (higher SoundEvent) that is still playing.
+void playEvent(uint8_t event) {
+  if(feedback.volume == 0 || !(feedback.enabled & (1 << event))) {
+    return;
+  }
+  if(buzzer.isPlaying()) {
+    if(sndPlaying < sndCount && sndPlaying > event) {
+      return;
+    }
+    buzzer.stopPlaying();
+  }
+  sndBuffer[0] = 'V';
+  uint8_t n = 1;
+  if(feedback.volume >= 10) sndBuffer[n++] = '1';
+  sndBuffer[n++] = '0' + feedback.volume % 10;
+  sndBuffer[n++] = ' ';
+  strncpy_P(sndBuffer + n, (const char*)pgm_read_ptr(&eventTunes[event]), sizeof(sndBuffer) - n - 1);
+  sndBuffer[sizeof(sndBuffer) - 1] = 0;
+  sndPlaying = event;
+  buzzer.play(sndBuffer);
+}
+
+//Marks text rows (bit per row) to be sent by displayService().
+void displayQueue(uint8_t rows) {
+  dispPending |= rows;
+}
+
+//Sends queued rows to the OLED, at most maxRows and within budgetUs, and
+//resumes where it stopped on the next call. Whole rows are sent, so a row
+//never shows half old and half new text. At least one row is sent per call
+//so the worst case is max(maxRows, 1) rows. Returns the rows still pending.
+uint8_t displayService(uint8_t maxRows, uint16_t budgetUs) {
+  unsigned long start = micros();
+  uint8_t sent = 0;
+  while(dispPending != 0 && sent < maxRows) {
+    if(sent > 0 && (micros() - start) + dispRowUs > budgetUs) {
+      break;
+    }
+    //next pending row, round robin
+    while(!(dispPending & (1 << dispNextRow))) {
+      dispNextRow = (dispNextRow + 1) % dispRows;
+    }
+    unsigned long rowStart = micros();
+    display.displayPartial(dispNextRow, 0, 21);
+    uint16_t cost = micros() - rowStart;
+    dispRowUs = ((uint32_t)dispRowUs * 3 + cost) / 4;
+    dispPending &= ~(1 << dispNextRow);
+    dispNextRow = (dispNextRow + 1) % dispRows;
+    sent++;
+  }
+  return dispPending;
+}
+
+//Starts a maneuver leg: leg tick counts restart from 0.
+void legBegin(long* left, long* right) {
+  encoderUpdate();
+  legMark[0] = encTotal[0];
+  legMark[1] = encTotal[1];
+  *left = 0;
+  *right = 0;
+}
+
+//Ticks each wheel has moved since legBegin().
+void legUpdate(long* left, long* right) {
+  encoderUpdate();
+  *left = encTotal[0] - legMark[0];
+  *right = encTotal[1] - legMark[1];
+}
+
+//Reads up to serialBytesPerCall bytes and runs each complete line. Never
+//waits for input, so it can be called from every control loop pass.
+void serialService() {
+  for(uint8_t n = 0; n < serialBytesPerCall && Serial.available() > 0; n++) {
+    char c = Serial.read();
+    if(c == '\n' || c == '\r') {
+      if(serialOverflow) {
+        Serial.println(F("err too long"));
+      } else if(serialLen > 0) {
+        serialLine[serialLen] = 0;
+        serialCommand(serialLine);
+      }
+      serialLen = 0;
+      serialOverflow = false;
+    } else if(serialLen < serialLineMax - 1) {
+      serialLine[serialLen++] = c;
+    } else {
+      serialOverflow = true;
+    }
+  }
+}
+
+//Runs one command line (modified in place).
+void serialCommand(char* line) {
+  char* cmd = strtok(line, " ");
+  char* arg1 = strtok(NULL, " ");
+  char* arg2 = strtok(NULL, " ");
+  if(!cmd) {
+    return;
+  }
+
+  if(strcmp_P(cmd, PSTR("get")) == 0 && arg1) {
+    int8_t i = findParam(arg1);
+    if(i < 0) {
+      Serial.println(F("err name"));
+    } else {
+      printParam(i);
+    }
+  }
+  else if(strcmp_P(cmd, PSTR("set")) == 0 && arg1 && arg2) {
+    int8_t i = findParam(arg1);
+    char* end;
+    long value = strtol(arg2, &end, 10);
+    if(i < 0) {
+      Serial.println(F("err name"));
+    } else if(*end != 0) {
+      Serial.println(F("err value"));
+    } else if(value < (int)pgm_read_word(&params[i].minVal) || value > (int)pgm_read_word(&params[i].maxVal)) {
+      Serial.println(F("err range"));
+    } else {
+      *(int*)pgm_read_ptr(&params[i].value) = value;
+      printParam(i);
+    }
+  }
+  else if(strcmp_P(cmd, PSTR("list")) == 0) {
+    for(uint8_t i = 0; i < paramCount; i++) {
+      printParam(i);
+    }
+  }
+  else if(strcmp_P(cmd, PSTR("start")) == 0 && arg1) {
+    if(runMode > 2) {
+      Serial.println(F("err busy"));
+    } else if(strcmp_P(arg1, PSTR("roam")) == 0) {
+      serialStart = 11;
+      Serial.println(F("ok"));
+    } else if(strcmp_P(arg1, PSTR("bench")) == 0) {
+      serialStart = 14;
+      Serial.println(F("ok"));
+    } else if(strcmp_P(arg1, PSTR("cover")) == 0) {
+      serialStart = 15;
+      Serial.println(F("ok"));
+    } else {
+      Serial.println(F("err mode"));
+    }
+  }
+  else if(strcmp_P(cmd, PSTR("result")) == 0) {
+    if(!lastRunValid) {
+      Serial.println(F("err none"));
+    } else {
+      Serial.print(F("durS="));
+      Serial.print(lastRun.durationS);
+      Serial.print(F(" distCm="));
+      Serial.print(lastRun.distCm);
+      Serial.print(F(" bumps="));
+      Serial.print(lastRun.bumps);
+      Serial.print(F(" edges="));
+      Serial.print(lastRun.edges);
+      Serial.print(F(" corners="));
+      Serial.print(lastRun.corners);
+      Serial.print(F(" maneuverPct="));
+      Serial.print(lastRun.maneuverPct);
+      Serial.print(F(" loopUs="));
+      Serial.print(lastRun.loopUs);
+      Serial.print(F(" score="));
+      Serial.println(lastRun.score);
+    }
+  }
+  else if(strcmp_P(cmd, PSTR("stop")) == 0) {
+    serialStop = true;
+    Serial.println(F("ok"));
+  }
+  else if(strcmp_P(cmd, PSTR("fault")) == 0) {
+    if(arg1 && strcmp_P(arg1, PSTR("clear")) == 0) {
+      FaultLog log = {faultMagic & 0xFF, 0, faultNone, 0};
+      EEPROM.put(eeFaultLog, log);
+    }
+    superPrint();
+  }
+  else if(strcmp_P(cmd, PSTR("script")) == 0) {
+    char* end = NULL;
+    long n = arg1 ? strtol(arg1, &end, 10) : -1;
+    if(!arg1) {
+      for(uint8_t i = 0; i < scrCount; i++) scriptPrint(i);
+    } else if(*end != 0) {
+      Serial.println(F("err value"));
+    } else if(n < 0 || n >= scrCount || !arg2) {
+      Serial.println(F("err arg"));
+    } else if(runMode > 2) {
+      Serial.println(F("err busy"));
+    } else if(strcmp_P(arg2, PSTR("clear")) == 0) {
+      scriptValid &= ~(1 << n);
+      EEPROM.update(eeScripts + offsetof(ScriptStore, valid), scriptValid);
+      scriptPrint(n);
+    } else {
+      //hex bytes, two digits each
+      uint8_t code[scriptMax];
+      uint8_t len = strlen(arg2) / 2;
+      bool ok = (strlen(arg2) % 2 == 0) && len > 0 && len <= scriptMax;
+      for(uint8_t i = 0; ok && i < len; i++) {
+        char byteHex[3] = {arg2[2 * i], arg2[2 * i + 1], 0};
+        char* end;
+        code[i] = strtoul(byteHex, &end, 16);
+        ok = (*end == 0);
+      }
+      if(!ok || !scriptCheck(code, len)) {
+        Serial.println(F("err script"));
+      } else {
+        for(uint8_t i = 0; i < len; i++) {
+          EEPROM.update(eeScripts + offsetof(ScriptStore, code) + n * scriptMax + i, code[i]);
+        }
+        scriptValid |= 1 << n;
+        EEPROM.update(eeScripts + offsetof(ScriptStore, valid), scriptValid);
+        EEPROM.update(eeScripts, scriptMagic);
+        scriptPrint(n);
+      }
+    }
+  }
+  else if(strcmp_P(cmd, PSTR("learn")) == 0) {
+    if(arg1 && strcmp_P(arg1, PSTR("reset")) == 0) {
+      learnReset();
+      learnSave();
+    }
+    learnPrint();
+  }
+  else if(strcmp_P(cmd, PSTR("status")) == 0) {
+    Serial.print(F("mode="));
+    Serial.print((int)runMode);
+    Serial.print(F(" batt="));
+    Serial.print(battMv);
+    Serial.print(F(" encL="));
+    Serial.print(encTotal[0]);
+    Serial.print(F(" encR="));
+    Serial.print(encTotal[1]);
+    Serial.print(F(" velL="));
+    Serial.print(encVel[0]);
+    Serial.print(F(" velR="));
+    Serial.print(encVel[1]);
+    Serial.print(F(" miss="));
+    Serial.print(superMisses);
+    Serial.print(F(" worstUs="));
+    Serial.println(superWorstUs);
+  }
+  else {
+    Serial.println(F("err cmd"));
+  }
+}
+
+//Index of a parameter by name, -1 if unknown.
+int8_t findParam(const char* name) {
+  for(uint8_t i = 0; i < paramCount; i++) {
+    if(strcmp_P(name, (const char*)pgm_read_ptr(&params[i].name)) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+//Prints name=value of a parameter.
+void printParam(uint8_t i) {
+  char name[16];
+  strncpy_P(name, (const char*)pgm_read_ptr(&params[i].name), sizeof(name) - 1);
+  name[sizeof(name) - 1] = 0;
+  Serial.print(name);
+  Serial.print('=');
+  Serial.println(*(int*)pgm_read_ptr(&params[i].value));
+}
+
+//Loads the learner table from EEPROM (defaults if unset).
+void learnBegin() {
+  EEPROM.get(eeLearn, learn);
+  if(learn.magic != learnMagic) {
+    learnReset();
+  }
+  learnPendTrig = -1;
+  learnDirty = false;
+  randomSeed(micros());
+}
+
+//All options start equal, with the default maneuver a hair ahead.
+void learnReset() {
+  learn.magic = learnMagic;
+  for(uint8_t t = 0; t < trigCount; t++) {
+    for(uint8_t o = 0; o < learnOptions; o++) {
+      learn.score[t][o] = (o == learnDefault) ? learnInitMs + 1 : learnInitMs;
+    }
+  }
+  learnDirty = true;
+}
+
+//Option for a trigger: the best scored one, or 1 in learnExplore a random
+//one so the others keep getting tried.
+uint8_t learnChoose(uint8_t trigger) {
+  if(!learnEnabled) {
+    return learnDefault;
+  }
+  if(random(learnExplore) == 0) {
+    return random(learnOptions);
+  }
+  uint8_t best = 0;
+  for(uint8_t o = 1; o < learnOptions; o++) {
+    if(learn.score[trigger][o] > learn.score[trigger][best]) best = o;
+  }
+  return best;
+}
+
+//An event happened: scores the pending maneuver by the time since it ended.
+void learnEvent() {
+  if(learnPendTrig < 0) {
+    return;
+  }
+  if(learnEnabled) {
+    unsigned long outcome = min(millis() - learnPendTime, (unsigned long)learnCapMs);
+    uint16_t* score = &learn.score[learnPendTrig][learnPendOpt];
+    *score += ((long)outcome - *score) >> learnShift;
+    learnDirty = true;
+  }
+  learnPendTrig = -1;
+}
+
+//Drops the pending maneuver without scoring it.
+void learnCancel() {
+  learnPendTrig = -1;
+}
+
+//Writes the learner table to EEPROM if it changed (only changed bytes are
+//written).
+void learnSave() {
+  if(learnDirty) {
+    EEPROM.put(eeLearn, learn);
+    learnDirty = false;
+  }
+}
+
+//Prints the learner scores (ms), one trigger per line.
+void learnPrint() {
+  for(uint8_t t = 0; t < trigCount; t++) {
+    Serial.print('t');
+    Serial.print(t);
+    Serial.print(':');
+    for(uint8_t o = 0; o < learnOptions; o++) {
+      Serial.print(' ');
+      Serial.print(learn.score[t][o]);
+    }
+    Serial.println();
+  }
+}
+
+//Copies a fault recorded before a reset to the EEPROM fault log.
+void superBoot() {
+  wdt_disable();
+  superPersist();
+}
+
+//Starts supervising a motion mode: passes over deadlineUs are counted and
+//the watchdog (interrupt, then reset) is armed at 500ms.
+void superBegin(uint16_t deadlineUs) {
+  superDeadlineUs = deadlineUs;
+  superMisses = 0;
+  superWorstUs = 0;
+  superFault = faultNone;
+  cli();
+  wdt_reset();
+  WDTCSR = _BV(WDCE) | _BV(WDE);
+  WDTCSR = _BV(WDIE) | _BV(WDE) | _BV(WDP2) | _BV(WDP0);
+  sei();
+}
+
+//Stops supervising and logs a fault if there was one.
+void superEnd() {
+  wdt_disable();
+  superPersist();
+}
+
+//Kicks the watchdog at the end of a control pass that took passUs and
+//counts a deadline miss if it ran over. Returns false once faulted.
+bool superPass(unsigned long passUs) {
+  wdt_reset();
+  if(passUs > superDeadlineUs) superMisses++;
+  if(passUs > superWorstUs) superWorstUs = passUs;
+  return superFault == faultNone;
+}
+
+//Kicks the watchdog inside a maneuver leg started at legStart (ms). Returns
+//false, after a safe stop, once the leg has run for legTimeoutMs.
+bool superLeg(unsigned long legStart) {
+  wdt_reset();
+  if(superFault == faultNone && millis() - legStart > legTimeoutMs) {
+    superStop(faultLegTimeout);
+  }
+  return superFault == faultNone;
+}
+
+//Kicks the watchdog inside a leg of no fixed length started at legStartUs.
+//Returns false, after a safe stop, once either wheel has gone
+//stallTimeoutMs without a tick.
+bool superStall(unsigned long legStartUs) {
+  wdt_reset();
+  unsigned long now = micros();
+  for(uint8_t i = 0; i < 2; i++) {
+    unsigned long last = ((long)(encTickTime[i] - legStartUs) > 0) ? encTickTime[i] : legStartUs;
+    if(superFault == faultNone && now - last > stallTimeoutMs * 1000UL) {
+      superStop(faultStall);
+    }
+  }
+  return superFault == faultNone;
+}
+
+//Safe stop: motors off and the fault kept in RAM that survives a reset.
+//Also called from the watchdog interrupt.
+void superStop(uint8_t reason) {
+  motors.setSpeeds(0, 0);
+  superFault = reason;
+  faultRecord.reason = reason;
+  faultRecord.mode = runMode;
+  faultRecord.magic = faultMagic;
+}
+
+//Moves a recorded fault to the EEPROM log.
+void superPersist() {
+  if(faultRecord.magic != faultMagic || faultRecord.reason >= faultCount) {
+    return;
+  }
+  FaultLog log;
+  EEPROM.get(eeFaultLog, log);
+  if(log.magic != (faultMagic & 0xFF)) {
+    log.magic = faultMagic & 0xFF;
+    log.count = 0;
+  }
+  if(log.count < 255) log.count++;
+  log.reason = faultRecord.reason;
+  log.mode = faultRecord.mode;
+  EEPROM.put(eeFaultLog, log);
+  faultRecord.magic = 0;
+}
+
+//Prints the fault log and the last mode's deadline statistics.
+void superPrint() {
+  FaultLog log;
+  EEPROM.get(eeFaultLog, log);
+  if(log.magic != (faultMagic & 0xFF) || log.reason >= faultCount) {
+    log.count = 0;
+    log.reason = faultNone;
+    log.mode = 0;
+  }
+  char name[12];
+  strcpy_P(name, faultNames[log.reason]);
+  Serial.print(F("faults="));
+  Serial.print(log.count);
+  Serial.print(F(" last="));
+  Serial.print(name);
+  Serial.print(F(" mode="));
+  Serial.print(log.mode);
+  Serial.print(F(" deadlineUs="));
+  Serial.print(superDeadlineUs);
+  Serial.print(F(" miss="));
+  Serial.println(superMisses);
+}
+
+//Shows the fault that ended a motion mode, if any, on rows 1-2 for 2s.
+void superShowFault() {
+  if(superFault == faultNone) {
+    return;
+  }
+  char name[12];
+  strcpy_P(name, faultNames[superFault]);
+  display.gotoXY(0,1);
+  display.print("FAULT:     ");
+  display.gotoXY(0,2);
+  display.print(name);
+  display.display();
+  delay(2000);
+}
+
+//Watchdog interrupt: the control loop missed the kick. Stops the robot;
+//the next timeout resets it.
+ISR(WDT_vect) {
+  superStop(faultWatchdog);
+}
+
+//Reads which scripts have been uploaded to EEPROM.
+void vmBegin() {
+  if(EEPROM.read(eeScripts) == scriptMagic) {
+    scriptValid = EEPROM.read(eeScripts + offsetof(ScriptStore, valid));
+  } else {
+    scriptValid = 0;
+  }
+}
+
+//Starts a script (uploaded one if any, else built in) and its first op.
+void vmStart(uint8_t script) {
+  setMotors(0, 0);
+  vmScript = script;
+  vmEeprom = scriptValid & (1 << script);
+  vmPc = 0;
+  vmSteps = 0;
+  vmTrig = -1;
+  vmOpt = learnDefault;
+  vmRunning = false;
+  vmActive = true;
+  vmStep();
+}
+
+//Advances the running script by one control tick: checks the motion op in
+//progress, and once it is done runs ops up to the next motion op. Returns
+//false when the script has ended.
+bool vmStep() {
+  if(!vmActive) {
+    return false;
+  }
+  if(vmRunning) {
+    if(!vmOpDone()) {
+      return true;
+    }
+    vmRunning = false;
+    setMotors(0, 0);
+  }
+  while(!vmRunning) {
+    if(superFault != faultNone || ++vmSteps > vmMaxSteps) {
+      vmOp = opEnd;
+    } else {
+      vmOp = vmFetch();
+    }
+    switch (vmOp) {
+    case opStop:
+      setMotors(0, 0);
+      break;
+    case opRev:
+    case opFwd:
+    case opWait:
+      vmArg = vmFetchArg();
+      vmRunning = true;
+      break;
+    case opSpin:
+    case opPivot: {
+      bool right = (vmFetch() == dirRight);
+      vmArg = vmFetchArg();
+      if(vmOpt >= 3) {
+        right = !right;
+      }
+      vmArg = ((long)vmArg * learnScalePct[vmOpt % 3]) / 100;
+      if(vmOp == opSpin) {
+        vmDirL = right ? 1 : -1;
+        vmDirR = -vmDirL;
+      } else {
+        vmDirL = right ? 0 : -1;
+        vmDirR = right ? -1 : 0;
+      }
+      vmRunning = true;
+      break;
+    }
+    case opBranch: {
+      uint8_t cond = vmFetch();
+      uint8_t target = vmFetch();
+      if(vmCond(cond)) {
+        vmPc = target;
+      }
+      break;
+    }
+    case opLearn:
+      vmTrig = vmFetch();
+      if(vmTrig >= trigCount) vmTrig = -1;
+      vmOpt = (vmTrig < 0) ? learnDefault : learnChoose(vmTrig);
+      break;
+    default:
+      //opEnd: the outcome of the learned turn is scored at the next event
+      setMotors(0, 0);
+      if(vmTrig >= 0) {
+        learnPendTrig = vmTrig;
+        learnPendOpt = vmOpt;
+        learnPendTime = millis();
+      }
+      vmActive = false;
+      return false;
+    }
+    if(vmRunning) {
+      vmOpStart = millis();
+      legBegin(&vmLegL, &vmLegR);
+    }
+  }
+  return true;
+}
+
+//Drives the motion op in progress for this tick; true once it is done.
+bool vmOpDone() {
+  if(vmOp == opWait) {
+    return millis() - vmOpStart >= (unsigned int)vmArg;
+  }
+  if(!superLeg(vmOpStart)) {
+    return true;
+  }
+  legUpdate(&vmLegL, &vmLegR);
+  switch (vmOp) {
+  case opRev:
+    if(vmLegL <= -vmArg || vmLegR <= -vmArg) return true;
+    driveStraight(-motorSpeedRev, vmLegL, vmLegR);
+    break;
+  case opFwd:
+    if(vmLegL >= vmArg || vmLegR >= vmArg) return true;
+    driveStraight(motorSpeed, vmLegL, vmLegR);
+    break;
+  case opPivot:
+    if((vmDirL ? -vmLegL : -vmLegR) >= vmArg) return true;
+    setMotorsFF(vmDirL * motorSpeedTurn, vmDirR * motorSpeedTurn);
+    break;
+  default:
+    //opSpin
+    if((abs(vmLegL) + abs(vmLegR)) / 2 >= vmArg) return true;
+    setMotorsFF(vmDirL * motorSpeedTurn, vmDirR * motorSpeedTurn);
+    break;
+  }
+  return false;
+}
+
+//Stops a running script without scoring it.
+void vmAbort() {
+  if(vmActive) {
+    setMotors(0, 0);
+  }
+  vmActive = false;
+  vmRunning = false;
+}
+
+//Next script byte; past the end of an uploaded script reads as opEnd.
+uint8_t vmFetch() {
+  if(vmEeprom) {
+    if(vmPc >= scriptMax) return opEnd;
+    return EEPROM.read(eeScripts + offsetof(ScriptStore, code) + vmScript * scriptMax + vmPc++);
+  }
+  const uint8_t* code = (const uint8_t*)pgm_read_ptr(&vmScripts[vmScript]);
+  return pgm_read_byte(code + vmPc++);
+}
+
+//Next 16 bit argument, variables resolved.
+int vmFetchArg() {
+  uint8_t lo = vmFetch();
+  int16_t arg = (int16_t)(lo | (vmFetch() << 8));
+  if(arg < 0) {
+    uint8_t var = -1 - arg;
+    if(var >= varCount) return 0;
+    return *(int*)pgm_read_ptr(&vmVars[var]);
+  }
+  return arg;
+}
+
+//Branch condition on the last sensor read.
+bool vmCond(uint8_t cond) {
+  switch (cond) {
+  case condAlways:
+    return true;
+  case condBump:
+    return bumpSensors.leftIsPressed() || bumpSensors.rightIsPressed();
+  case condBumpL:
+    return bumpSensors.leftIsPressed();
+  case condBumpR:
+    return bumpSensors.rightIsPressed();
+  case condEdge:
+    return edgeMask != 0;
+  default:
+    return false;
+  }
+}
+
+//Bytes taken by an op and its arguments, 0 for an unknown op.
+uint8_t opSize(uint8_t op) {
+  switch (op) {
+  case opEnd:
+  case opStop:
+    return 1;
+  case opLearn:
+    return 2;
+  case opRev:
+  case opFwd:
+  case opWait:
+  case opBranch:
+    return 3;
+  case opSpin:
+  case opPivot:
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+//Checks an uploaded script: known ops, complete arguments, an opEnd, and
+//branches that land on the start of an op before it.
+bool scriptCheck(const uint8_t* code, uint8_t len) {
+  uint32_t opStarts = 0;                //bit per op start, up to the opEnd
+  uint8_t pc = 0;
+  bool ended = false;
+  while(pc < len && !ended) {
+    uint8_t op = code[pc];
+    uint8_t size = opSize(op);
+    if(size == 0 || pc + size > len) return false;
+    ended = (op == opEnd);
+    if(op == opLearn && code[pc + 1] >= trigCount) return false;
+    opStarts |= 1UL << pc;
+    pc += size;
+  }
+  if(!ended) {
+    return false;
+  }
+  for(pc = 0; pc < len; pc++) {
+    if((opStarts & (1UL << pc)) && code[pc] == opBranch) {
+      uint8_t target = code[pc + 2];
+      if(target >= 32 || !(opStarts & (1UL << target))) return false;
+    }
+  }
+  return true;
+}
+
+//Prints a script slot as hex, "*" marking an uploaded one.
+void scriptPrint(uint8_t n) {
+  bool eeprom = scriptValid & (1 << n);
+  Serial.print(n);
+  Serial.print(eeprom ? '*' : ' ');
+  Serial.print(' ');
+  const uint8_t* code = (const uint8_t*)pgm_read_ptr(&vmScripts[n]);
+  //walk op by op: argument bytes may be 0 too
+  uint8_t nextOp = 0;
+  bool end = false;
+  for(uint8_t pc = 0; pc < scriptMax && !end; pc++) {
+    uint8_t b;
+    if(eeprom) {
+      b = EEPROM.read(eeScripts + offsetof(ScriptStore, code) + n * scriptMax + pc);
+    } else {
+      b = pgm_read_byte(code + pc);
+    }
+    if(b < 0x10) Serial.print('0');
+    Serial.print(b, HEX);
+    if(pc == nextOp) {
+      uint8_t size = opSize(b);
+      end = (b == opEnd || size == 0);
+      nextOp += size;
+    }
+  }
+  Serial.println();
+}
@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+"""Host CLI for the 3pi+ Auto Roaming serial command interface.
+
+Usage:
+  tpcli.py [-p PORT] list
+  tpcli.py [-p PORT] get <name>
+  tpcli.py [-p PORT] set <name> <value>
+  tpcli.py [-p PORT] start roam|bench|cover
+  tpcli.py [-p PORT] stop
+  tpcli.py [-p PORT] status
+  tpcli.py [-p PORT] result
+  tpcli.py [-p PORT] learn [reset]
+  tpcli.py [-p PORT] fault [clear]
+  tpcli.py [-p PORT] script [<n> <hex> | <n> clear]
+  tpcli.py [-p PORT] sweep <name> <first> <last> <step> [--run SECONDS]
+  tpcli.py [-p PORT] shell
+
+sweep sets the parameter to each value in turn and, with --run, starts a
+roaming run for that many seconds and prints the run result (distance,
+bumps, edges, score) after each one.
+
+Requires pyserial (pip install pyserial).
+"""
+
+import argparse
+import sys
+import time
+
+import serial
+
+
+def open_port(port):
+    conn = serial.Serial(port, 115200, timeout=1)
+    time.sleep(0.2)
+    conn.reset_input_buffer()
+    return conn
+
+
+def command(conn, line, lines=1):
+    """Sends one command line and returns the first `lines` reply lines."""
+    conn.write((line + "\n").encode("ascii"))
+    replies = []
+    while len(replies) < lines:
+        reply = conn.readline().decode("ascii", "replace").strip()
+        if not reply:
+            break
+        replies.append(reply)
+    return replies
+
+
+def command_all(conn, line):
+    """Sends one command line and returns reply lines until the port is quiet."""
+    conn.write((line + "\n").encode("ascii"))
+    replies = []
+    while True:
+        reply = conn.readline().decode("ascii", "replace").strip()
+        if not reply:
+            return replies
+        replies.append(reply)
+
+
+def sweep(conn, name, first, last, step, run_s):
+    value = first
+    while (step > 0 and value <= last) or (step < 0 and value >= last):
+        print(" ".join(command(conn, "set %s %d" % (name, value))))
+        if run_s:
+            print(" ".join(command(conn, "start roam")))
+            time.sleep(run_s)
+            print(" ".join(command(conn, "stop")))
+            print(" ".join(command(conn, "result")))
+            # let the robot return to the menu before the next run
+            time.sleep(1)
+        value += step
+
+
+def shell(conn):
+    print("Type commands, empty line or Ctrl-D to quit.")
+    for line in sys.stdin:
+        line = line.strip()
+        if not line:
+            break
+        for reply in command_all(conn, line):
+            print(reply)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="3pi+ Auto Roaming serial CLI")
+    parser.add_argument("-p", "--port", default="/dev/ttyACM0")
+    parser.add_argument("cmd", choices=["list", "get", "set", "start", "stop",
+                                        "status", "result", "learn", "fault",
+                                        "script", "sweep", "shell"])
+    parser.add_argument("args", nargs="*")
+    parser.add_argument("--run", type=float, default=0,
+                        help="sweep: roam this many seconds per value")
+    opts = parser.parse_args()
+
+    conn = open_port(opts.port)
+    if opts.cmd in ("list", "learn") or (opts.cmd == "script" and not opts.args):
+        replies = command_all(conn, " ".join([opts.cmd] + opts.args))
+    elif opts.cmd == "sweep":
+        if len(opts.args) != 4:
+            parser.error("sweep needs <name> <first> <last> <step>")
+        name = opts.args[0]
+        first, last, step = (int(a) for a in opts.args[1:])
+        sweep(conn, name, first, last, step, opts.run)
+        return
+    elif opts.cmd == "shell":
+        shell(conn)
+        return
+    else:
+        replies = command(conn, " ".join([opts.cmd] + opts.args))
+
+    for reply in replies:
+        print(reply)
+    if any(r.startswith("err") for r in replies):
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()